@@ -0,0 +1,135 @@
+// Name: adc.c
+//
+// The producer/consumer example from main.c the other way around: the ADC conversion complete
+// ISR is the producer and main() is the consumer. The ADC runs in free running mode at its
+// fastest 10-bit rate, CLK_io / 128 / 13 (11.1 kHz at 18.432MHz), and every conversion is
+// enqueued. main() dequeues the samples in batches of BATCH_SAMPLES and processes them: here
+// the minimum, maximum and mean of the last WINDOW_SAMPLES samples (see window.h), and a low
+// pass filtered value.
+//
+// The queue is the same one as before (see ring.h), with the roles swapped: the ISR only writes
+// tail and main() only writes head. An ISR cannot wait for room, so when main() falls behind
+// and the queue is full, the sample is dropped and counted as an overrun. The count is only
+// ever modified by the ISR, main() reports how much it went up since last time.
+//
+// Build with "make TARGET=adc".
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+// Only main() prints, so that the ISR is never held off long enough to miss a conversion
+#define LOG_SINGLE_CONTEXT
+#include "log.h"
+#include "ring.h"
+#include "sched.h"
+#include "window.h"
+
+// Holds 23 ms of samples at 11.1 kHz
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 256
+#endif
+
+#ifndef BATCH_SAMPLES
+#define BATCH_SAMPLES 64
+#endif
+
+#if BATCH_SAMPLES >= QUEUE_LENGTH
+#error "BATCH_SAMPLES must be less than QUEUE_LENGTH"
+#endif
+
+// Samples the statistics are over
+#ifndef WINDOW_SAMPLES
+#define WINDOW_SAMPLES 64
+#endif
+
+// Analog input to sample, ADC0 is pin PC0
+#ifndef ADC_CHANNEL
+#define ADC_CHANNEL 0
+#endif
+
+// Print the results of every this many batches
+#ifndef REPORT_EVERY
+#define REPORT_EVERY 16
+#endif
+
+RING_DEFINE(SampleQueue, uint16_t, QUEUE_LENGTH)
+
+SampleQueue queue;
+
+WINDOW_DEFINE(SampleWindow, uint16_t, uint32_t, WINDOW_SAMPLES)
+
+SampleWindow window;
+
+// Samples dropped because the queue was full, only ever modified by the ISR
+volatile uint16_t overruns = 0;
+
+// AVcc reference, free running at CLK_io / 128, interrupt after each conversion
+static void ADC_Init(void) {
+	ADMUX = (1 << REFS0) | ADC_CHANNEL;
+	DIDR0 = (1 << ADC_CHANNEL);		// the digital input buffer only wastes power on an analog pin
+	ADCSRB = 0;						// free running
+	ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIE) |
+			 (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+	sei();
+	ADCSRA |= (1 << ADSC);
+}
+
+// The producer
+ISR(ADC_vect) {
+	uint16_t sample = ADC;
+
+	if (SampleQueue_full(&queue)) {
+		overruns++;
+		return;
+	}
+	SampleQueue_enqueue(&queue, &sample);
+}
+
+// The consumer, it processes every complete batch on the queue each time it runs
+static uint16_t consume(uint8_t unused) {
+	static uint16_t filtered = 0;			// 1/16 of the way to each new sample, times 16
+	static uint16_t last_overruns = 0;
+	static uint8_t batches = 0;
+	(void)unused;
+
+	while (SampleQueue_count(&queue) >= BATCH_SAMPLES) {
+		for (uint8_t i = 0; i < BATCH_SAMPLES; i++) {
+			uint16_t sample;
+			SampleQueue_dequeue(&queue, &sample);
+			SampleWindow_push(&window, sample);
+			filtered += sample - (filtered >> 4);
+		}
+
+		if (++batches == REPORT_EVERY) {
+			batches = 0;
+
+			uint16_t total;
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				total = overruns;
+			}
+			LOG("##### ADC: mean %u min %u max %u filtered %u overruns %u\n",
+				SampleWindow_mean(&window), SampleWindow_min(&window), SampleWindow_max(&window),
+				filtered >> 4, (uint16_t)(total - last_overruns));
+			last_overruns = total;
+		}
+	}
+
+	// A batch takes 5.8 ms to come in at 11.1 kHz, have a look twice as often
+	return (uint32_t)BATCH_SAMPLES * 13 * 128 / 256 / 2;
+}
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+	LOG("ADC Acquisition Example\n\n");
+
+	sched_init();
+	ADC_Init();
+
+	static Task tasks[] = { { consume, 0, 0 } };
+	sched_run(tasks, 1);
+
+	return 0;
+}
@@ -0,0 +1,231 @@
+// Name: audio.c
+//
+// Audio playback through the lock-free queue. The producer in main() enqueues 8-bit samples as
+// they arrive from their source, and the Timer 2 compare match ISR plays one per period of the
+// sample rate by setting the duty cycle of Timer 0's fast PWM output (OC0A, pin PD6). An RC low
+// pass filter on the pin turns it into an analog signal.
+//
+// The source runs on its own clock (e.g. the PC sending samples over the USART), which is never
+// exactly as fast as ours, so the queue is a jitter buffer that would slowly fill up or drain.
+// A control task watches the buffer level and trims the playback sample rate, in 1/256ths of a
+// Timer 2 tick, to keep the level at AUDIO_TARGET_LEVEL. The ISR spreads the fraction over the
+// periods with an accumulator, so the average period is exact even though OCR2A is 8 bits.
+//
+// The ISR only does a dequeue and a register write, which is what makes 8-16 kHz possible. Any
+// text is printed by main(), the ISR counts underruns, and the producer counts overruns, i.e.
+// samples dropped because the buffer was full.
+//
+// By default the source is a 250 Hz sine wave generated at AUDIO_RATE_HZ plus AUDIO_SOURCE_PPM,
+// to show the trimming at work. Define AUDIO_SOURCE_UART to play raw 8-bit samples received
+// over the USART instead; at 115200 baud that is up to 11520 samples per second. The producer
+// is then the USART receive complete ISR, like in adc.c: the receiver only holds two bytes,
+// which main() could not be relied on to pick up in time while it prints the status line.
+//
+// Build with "make TARGET=audio".
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+// Only main() prints, and the ISRs must not miss a sample period or a byte while it does
+#define LOG_SINGLE_CONTEXT
+#include "log.h"
+#include "ring.h"
+#include "sched.h"
+
+#ifndef AUDIO_RATE_HZ
+#define AUDIO_RATE_HZ 8000
+#endif
+
+// Timer 2 runs at CLK_io / 32, and the period of the sample rate in its ticks must fit OCR2A
+#define AUDIO_TIMER_HZ (F_CPU / 32)
+#define AUDIO_PERIOD_Q8 ((AUDIO_TIMER_HZ * 256L + AUDIO_RATE_HZ / 2) / AUDIO_RATE_HZ)
+
+#if AUDIO_PERIOD_Q8 > 256 * 256L || AUDIO_PERIOD_Q8 < 16 * 256L
+#error "AUDIO_RATE_HZ is out of range for Timer 2 at CLK_io / 32"
+#endif
+
+// Largest trim, in either direction, about 1.5%
+#define AUDIO_TRIM_MAX ((int16_t)(AUDIO_PERIOD_Q8 / 64))
+
+// The queue length is the longest glitch (or drift) the buffer can hide, 32 ms at 8 kHz
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 256
+#endif
+
+#ifndef AUDIO_TARGET_LEVEL
+#define AUDIO_TARGET_LEVEL (QUEUE_LENGTH / 2)
+#endif
+
+// How often the buffer level is checked, and the status printed
+#define AUDIO_CONTROL_MS 100
+#define AUDIO_STATUS_EVERY 10
+
+// How much faster (or slower, if negative) the generated source runs than AUDIO_RATE_HZ
+#ifndef AUDIO_SOURCE_PPM
+#define AUDIO_SOURCE_PPM 500
+#endif
+
+RING_DEFINE(SampleQueue, uint8_t, QUEUE_LENGTH)
+
+SampleQueue queue;
+
+// Set by the producer once the buffer has filled up to the target, cleared by the ISR on underrun
+volatile uint8_t playing = 0;
+
+// Playback period adjustment in 1/256ths of a Timer 2 tick, written by main() only
+volatile int16_t trim = 0;
+
+// Only ever modified by the ISR
+volatile uint16_t underruns = 0;
+
+// Only ever modified by the producer
+volatile uint16_t overruns = 0;
+
+// Fast PWM on OC0A at CLK_io / 256 (72 kHz at 18.432MHz), well above what we can hear
+static void PWM_Init(void) {
+	DDRD |= (1 << PD6);
+	OCR0A = 128;
+	TCCR0A = (1 << COM0A1) | (1 << WGM01) | (1 << WGM00);
+	TCCR0B = (1 << CS00);
+}
+
+// CTC mode at CLK_io / 32, interrupting once per sample period
+static void Timer2_Init(void) {
+	TCCR2A = (1 << WGM21);
+	OCR2A = (AUDIO_PERIOD_Q8 >> 8) - 1;
+	TIMSK2 |= (1 << OCIE2A);
+	TCCR2B = (1 << CS21) | (1 << CS20);
+	sei();
+}
+
+// Plays the next sample, and sets up the length of the next period
+ISR(TIMER2_COMPA_vect) {
+	static uint8_t fraction = 0;
+
+	uint16_t period = AUDIO_PERIOD_Q8 + trim;
+	uint8_t carry = (uint8_t)(fraction + (uint8_t)period) < fraction;
+	fraction += (uint8_t)period;
+	OCR2A = (period >> 8) - 1 + carry;
+
+	if (!playing)
+		return;
+	if (SampleQueue_empty(&queue)) {
+		playing = 0;			// wait for the buffer to fill up again
+		underruns++;
+		return;
+	}
+	uint8_t sample;
+	SampleQueue_dequeue(&queue, &sample);
+	OCR0A = sample;
+}
+
+static void enqueue(uint8_t sample) {
+	if (SampleQueue_full(&queue)) {
+		overruns++;
+		return;
+	}
+	SampleQueue_enqueue(&queue, &sample);
+	if (!playing && SampleQueue_count(&queue) >= AUDIO_TARGET_LEVEL)
+		playing = 1;
+}
+
+#ifdef AUDIO_SOURCE_UART
+
+// The producer, called for every byte the USART receives. It does not nest with the Timer 2
+// ISR, so the queue still has one context on each side.
+ISR(USART_RX_vect) {
+	uint8_t sample = UDR0;
+	enqueue(sample);
+}
+
+#else
+
+static const uint8_t sine[32] = {
+	128, 153, 177, 199, 218, 234, 245, 253, 255, 253, 245, 234, 218, 199, 177, 153,
+	128, 103, 79, 57, 38, 22, 11, 3, 1, 3, 11, 22, 38, 57, 79, 103
+};
+
+// Samples per scheduler tick, as a 16.16 fixed point number
+#define SOURCE_STEP_Q16 ((uint32_t)((AUDIO_RATE_HZ * (1000000LL + AUDIO_SOURCE_PPM) * 65536 /		\
+							(1000000LL * (F_CPU / 256)))))
+
+static uint16_t source_last;
+
+// Generates the samples the source would have produced since the last run
+static uint16_t produce(uint8_t unused) {
+	static uint16_t acc = 0;
+	static uint8_t phase = 0;
+	(void)unused;
+
+	uint16_t now = sched_now();
+	uint32_t due = (uint32_t)(uint16_t)(now - source_last) * SOURCE_STEP_Q16 + acc;
+	source_last = now;
+	acc = due;
+	for (uint16_t n = due >> 16; n; n--)
+		enqueue(sine[phase++ % 32]);
+
+	return 4;
+}
+
+#endif // AUDIO_SOURCE_UART
+
+// Moves the buffer level towards the target by trimming the sample rate. A proportional term
+// reacts to bursts and an integral term, which ends up being the drift, removes the rest.
+static uint16_t control(uint8_t unused) {
+	static int16_t integral = 0;
+	static uint8_t status = 0;
+	(void)unused;
+
+	int16_t error = (int16_t)SampleQueue_count(&queue) - AUDIO_TARGET_LEVEL;
+	if (!playing)
+		error = 0;				// nothing to control while the buffer refills
+	integral += error;
+	if (integral > 8 * AUDIO_TRIM_MAX)
+		integral = 8 * AUDIO_TRIM_MAX;
+	if (integral < -8 * AUDIO_TRIM_MAX)
+		integral = -8 * AUDIO_TRIM_MAX;
+
+	// A fuller buffer needs a shorter period
+	int16_t t = -(error / 2 + integral / 8);
+	if (t > AUDIO_TRIM_MAX)
+		t = AUDIO_TRIM_MAX;
+	if (t < -AUDIO_TRIM_MAX)
+		t = -AUDIO_TRIM_MAX;
+
+	uint16_t u, o;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		trim = t;
+		u = underruns;
+		o = overruns;
+	}
+
+	if (++status == AUDIO_STATUS_EVERY) {
+		status = 0;
+		LOG("##### Audio: level %u trim %d underruns %u overruns %u\n",
+			SampleQueue_count(&queue), t, u, o);
+	}
+	return AUDIO_CONTROL_MS * SCHED_TICKS_PER_MS;
+}
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+	LOG("Audio Playback Example\n\n");
+
+	sched_init();
+#ifdef AUDIO_SOURCE_UART
+	USART_InitReceiver(1);
+	static Task tasks[] = { { control, 0, 0 } };
+#else
+	source_last = sched_now();
+	static Task tasks[] = { { produce, 0, 0 }, { control, 0, 0 } };
+#endif
+	PWM_Init();
+	Timer2_Init();
+
+	sched_run(tasks, sizeof(tasks) / sizeof(tasks[0]));
+
+	return 0;
+}
@@ -0,0 +1,37 @@
+// Name: example.h
+//
+// What main.c and the example programs built on it share: the RGB triplet their queues hold,
+// and the Timer 0 overflow interrupt that paces the consumer in main.c and frames.c.
+
+#ifndef EXAMPLE_H
+#define EXAMPLE_H
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// In this example our queues will hold RGB triplets
+struct _RGB {
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+};
+typedef struct _RGB RGB;
+
+// This sets up Timer 0 to be called every CLK_io / 256 / 256 cycles.
+// The second / 256 is there because we are only called on 8-bit overflow.
+static inline void Timer0_Init(void) {
+	// Normal port operation, OC0A disconnected; Normal
+	TCCR0A = 0;
+
+	// CLK_io / 256 (3.556 ms period at 18.432MHz)
+	TCCR0B |= (1 << CS02);
+
+	// Enable overflow interrupt
+	TIMSK0 |= (1 << TOIE0);
+
+	// Enable global interrupts
+	sei();
+}
+
+#endif
@@ -0,0 +1,167 @@
+// Name: fade.c
+//
+// The producer/consumer example from main.c with commands on the queue instead of colours.
+// Instead of enqueueing every colour an LED shows, the producer enqueues
+//
+//   FADE (r, g, b) over n ticks   move from the current colour to (r, g, b) in n steps
+//   HOLD n ticks                  keep the current colour
+//
+// and the consumer, the Timer 0 overflow ISR, works out the colour of each tick itself. A
+// command takes 6 bytes and can last up to 65535 ticks (almost 4 minutes at 281 Hz), so the
+// 8 commands on the queue describe seconds of output, where 8 colours would last 28 ms.
+//
+// The colour is kept in 8.8 fixed point, and each fade adds a per channel step, worked out
+// once when the command starts, on every tick. The step is the distance divided by the ticks,
+// truncated towards zero, so the colour can fall a little short, and the last tick of a fade
+// sets the target exactly instead of adding a step. Nothing on the queue when a command ends
+// means the colour just stays put, which is counted as starved ticks.
+//
+// The colour is output as PWM: red on OC0A (PD6) and green on OC0B (PD5) from Timer 0, which
+// runs in fast PWM mode with the same overflow rate as in main.c, and blue on OC2B (PD3) from
+// Timer 2.
+//
+// Build with "make TARGET=fade".
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+// Only main() prints, so that the ISR is never held off for the length of a line
+#define LOG_SINGLE_CONTEXT
+#include "example.h"
+#include "log.h"
+#include "ring.h"
+#include "sched.h"
+
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 8
+#endif
+
+// Print the state every this many ms, at most 455 (see sched.h)
+#ifndef REPORT_MS
+#define REPORT_MS 250
+#endif
+
+// Timer 0 overflows at CLK_io / 256 / 256
+#define TICKS_PER_S (F_CPU / 65536)
+
+enum { CMD_FADE, CMD_HOLD };
+
+struct _Command {
+	uint8_t op;			// CMD_FADE or CMD_HOLD
+	RGB rgb;			// target colour of a fade
+	uint16_t ticks;		// duration, at least 1
+};
+typedef struct _Command Command;
+
+RING_DEFINE(CommandQueue, Command, QUEUE_LENGTH)
+
+CommandQueue queue;
+
+// Current colour per channel in 8.8 fixed point, only ever modified by the ISR
+volatile uint16_t level[3];
+
+// Only ever modified by the ISR
+volatile uint16_t commands = 0;		// commands completed
+volatile uint16_t starved = 0;		// ticks without a command
+
+// Fast PWM on OC0A, OC0B and OC2B, CLK_io / 256, Timer 0 overflow interrupt
+static void PWM_Init(void) {
+	DDRD |= (1 << PD6) | (1 << PD5) | (1 << PD3);
+	TCCR0A = (1 << COM0A1) | (1 << COM0B1) | (1 << WGM01) | (1 << WGM00);
+	TCCR0B = (1 << CS02);
+	TCCR2A = (1 << COM2B1) | (1 << WGM21) | (1 << WGM20);
+	TCCR2B = (1 << CS22) | (1 << CS21);
+	TIMSK0 |= (1 << TOIE0);
+	sei();
+}
+
+// The consumer, one step of the current command per tick
+ISR(TIMER0_OVF_vect) {
+	static Command command;
+	static uint16_t remaining = 0;
+	static int16_t step[3];
+
+	if (!remaining) {
+		if (CommandQueue_empty(&queue)) {
+			starved++;
+			return;
+		}
+		CommandQueue_dequeue(&queue, &command);
+		remaining = command.ticks;
+
+		// The steps fit 16 bits from 2 ticks on, a 1 tick fade is only the exact last step
+		const uint8_t *target = &command.rgb.r;
+		for (uint8_t c = 0; c < 3; c++) {
+			int32_t distance = ((int32_t)target[c] << 8) - level[c];
+			step[c] = command.op == CMD_FADE && remaining > 1 ? distance / remaining : 0;
+		}
+	}
+
+	if (--remaining) {
+		for (uint8_t c = 0; c < 3; c++)
+			level[c] += step[c];
+	} else {
+		if (command.op == CMD_FADE) {
+			level[0] = command.rgb.r << 8;
+			level[1] = command.rgb.g << 8;
+			level[2] = command.rgb.b << 8;
+		}
+		commands++;
+	}
+
+	OCR0A = level[0] >> 8;
+	OCR0B = level[1] >> 8;
+	OCR2B = level[2] >> 8;
+}
+
+// The producer: a random fade of 0.25 to 2 s, sometimes followed by a hold of up to a second
+static uint16_t produce(uint8_t unused) {
+	(void)unused;
+
+	while (CommandQueue_count(&queue) < QUEUE_LENGTH - 2) {
+		Command fade = { CMD_FADE, { random(), random(), random() },
+						 TICKS_PER_S / 4 + random() % (TICKS_PER_S * 7 / 4) };
+		CommandQueue_enqueue(&queue, &fade);
+
+		if (random() % 2) {
+			Command hold = { CMD_HOLD, { 0, 0, 0 }, 1 + random() % TICKS_PER_S };
+			CommandQueue_enqueue(&queue, &hold);
+		}
+	}
+
+	// Even the shortest commands take longer than this to drain a slot or two
+	return 100 * SCHED_TICKS_PER_MS;
+}
+
+static uint16_t report(uint8_t unused) {
+	(void)unused;
+
+	uint16_t r, g, b, done, idle;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		r = level[0] >> 8;
+		g = level[1] >> 8;
+		b = level[2] >> 8;
+		done = commands;
+		idle = starved;
+	}
+	LOG("##### Fade: colour (%u, %u, %u) commands %u starved %u queue %u\n",
+		r, g, b, done, idle, CommandQueue_count(&queue));
+	return REPORT_MS * SCHED_TICKS_PER_MS;
+}
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+	LOG("Fade Command Example\n\n");
+
+	sched_init();
+	PWM_Init();
+
+	static Task tasks[] = { { produce, 0, 0 }, { report, 0, 0 } };
+	sched_run(tasks, 2);
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+// Name: frames.c
+//
+// The producer/consumer example from main.c with messages that are too large for the queue.
+// Each message is a frame of FRAME_PIXELS RGB triplets (e.g. for a strip of LEDs), which would
+// make every slot of the queue FRAME_PIXELS * 3 bytes. Instead, the frames live in a pool of
+// blocks (see pool.h) and the queue only carries the 1-byte handle of each frame.
+//
+// The producer takes a block from the pool, fills in a frame and enqueues its handle. The ISR
+// dequeues a handle, outputs the frame and gives the block back to the pool. Running out of
+// blocks plays the role the full queue plays in main.c.
+//
+// Build with "make TARGET=frames".
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdlib.h>
+
+#include "example.h"
+#include "log.h"
+#include "pool.h"
+#include "ring.h"
+#include "sched.h"
+
+// Number of pixels in a frame
+#ifndef FRAME_PIXELS
+#define FRAME_PIXELS 16
+#endif
+
+struct _Frame {
+	RGB pixels[FRAME_PIXELS];
+};
+typedef struct _Frame Frame;
+
+// Number of frames in the pool, which is what limits how far ahead the producer can get.
+// Keep in mind that the pool takes POOL_BLOCKS * FRAME_PIXELS * 3 bytes of the 2K of RAM.
+#ifndef POOL_BLOCKS
+#define POOL_BLOCKS 24
+#endif
+
+// A queue that can hold every handle is never full, so only the pool needs checking
+#define QUEUE_LENGTH (POOL_BLOCKS + 1)
+
+// Number of frames that must be queued before the producer enables the consumer
+#ifndef CONSUMER_START_LEVEL
+#define CONSUMER_START_LEVEL POOL_BLOCKS
+#endif
+
+// Initial number of timer cycles between dequeues. Set to 1 to auto-calibrate.
+#ifndef CONSUME_EVERY
+#define CONSUME_EVERY 1
+#endif
+
+// How many ms the producer waits after each frame, standing in for real work
+#ifndef PRODUCER_DELAY_MS
+#define PRODUCER_DELAY_MS(q) (random() % 16)
+#endif
+
+POOL_DEFINE(FramePool, Frame, POOL_BLOCKS)
+RING_DEFINE(HandleQueue, uint8_t, QUEUE_LENGTH)
+
+FramePool pool;
+HandleQueue queue;
+
+// Initially start with the consumer disabled, since we want frames to queue up first
+volatile uint8_t enable_consumer = 0;
+
+// The consumer, see main.c for how consume_every is calibrated
+ISR(TIMER0_OVF_vect) {
+	static uint8_t cycle = 0;
+	static uint8_t consume_every = CONSUME_EVERY;
+
+	if (!enable_consumer || ++cycle < consume_every)
+		return;
+	cycle = 0;
+
+	if (HandleQueue_empty(&queue)) {
+		consume_every++;		// wait an additional cycle next time
+		enable_consumer = 0;	// wait for frames to queue up before we try again
+		LOG("Queue is empty! Increased consume_every to: %d\n", consume_every);
+		return;
+	}
+
+	uint8_t handle;
+	HandleQueue_dequeue(&queue, &handle);
+	Frame *frame = FramePool_block(&pool, handle);
+
+	// Do something interesting with the frame, here we add up its pixels to show that all of
+	// it arrived. The first pixel identifies the frame.
+	uint16_t sum = 0;
+	for (uint8_t i = 0; i < FRAME_PIXELS; i++)
+		sum += frame->pixels[i].r + frame->pixels[i].g + frame->pixels[i].b;
+	RGB first = frame->pixels[0];
+
+	// Done with it, the producer can have the block back
+	FramePool_free(&pool, handle);
+
+	LOG("<<<<< Consumed: (%d, %d, %d) consuming every: %d sum: %u\n",
+		first.r, first.g, first.b, consume_every, sum);
+}
+
+// The color the next frame starts with
+static RGB next_rgb;
+
+// The producer task, it fills in one frame each time it runs
+static uint16_t produce(uint8_t unused) {
+	(void)unused;
+
+	if (HandleQueue_count(&queue) >= CONSUMER_START_LEVEL)
+		enable_consumer = 1;
+
+	uint8_t handle;
+	if (!FramePool_alloc(&pool, &handle)) {
+		enable_consumer = 1;	// out of blocks, so the consumer had better start
+		return 1;
+	}
+
+	// A gradient from the next color on, in place, so the frame is never copied
+	Frame *frame = FramePool_block(&pool, handle);
+	RGB rgb = next_rgb;
+	for (uint8_t i = 0; i < FRAME_PIXELS; i++) {
+		frame->pixels[i] = rgb;
+		rgb.b += 8;
+	}
+	HandleQueue_enqueue(&queue, &handle);
+
+	// Count through all 2^24 colors like main.c does, one per frame
+	if (++next_rgb.b == 0 && ++next_rgb.g == 0)
+		++next_rgb.r;
+
+	return (uint16_t)PRODUCER_DELAY_MS(0) * SCHED_TICKS_PER_MS;
+}
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+	LOG("Frame Pool Example\n\n");
+
+	FramePool_init(&pool);
+	sched_init();
+	Timer0_Init();
+
+	static Task tasks[] = { { produce, 0, 0 } };
+	sched_run(tasks, 1);
+
+	return 0;
+}
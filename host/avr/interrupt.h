@@ -0,0 +1,20 @@
+// Name: avr/interrupt.h
+//
+// Host stand-in for avr-libc's <avr/interrupt.h>. An ISR is an ordinary function that sim.c
+// calls when the corresponding (simulated) interrupt fires with interrupts enabled.
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include "sim.h"
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#endif // SIM_AVR_INTERRUPT_H
@@ -0,0 +1,205 @@
+// Name: avr/io.h
+//
+// Host stand-in for avr-libc's <avr/io.h> (ATmega328P subset). Most registers are plain
+// variables defined in sim.c that the simulator inspects, but the USART status and data
+// registers are routed through functions so that polling UDRE0 and writing UDR0 take as long
+// as the real transmitter would, and TCNT0 and TCNT1 are computed from the clock whenever they
+// are read. Writes to them are ignored, the timers only ever count freely.
+//
+// UDR0 is an lvalue of a 16-bit slot: reads must be assigned to a uint8_t before use, which lets
+// the simulator tell a written byte (< 0x100) from a slot that was read (0x100 | received byte).
+// TWCR and SPDR work the same way. TWCR must therefore be written with a plain assignment,
+// never with |= or &= (which would write TWINT back on the real chip too).
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+#include "sim.h"
+
+// I/O ports
+extern volatile uint8_t PINB, DDRB, PORTB, PINC, DDRC, PORTC, PIND, DDRD, PORTD;
+
+#define PB0		0
+#define PB1		1
+#define PB2		2
+#define PB3		3
+#define PB4		4
+#define PB5		5
+#define PB6		6
+#define PB7		7
+#define PC0		0
+#define PC1		1
+#define PC2		2
+#define PC3		3
+#define PC4		4
+#define PC5		5
+#define PC6		6
+#define PD0		0
+#define PD1		1
+#define PD2		2
+#define PD3		3
+#define PD4		4
+#define PD5		5
+#define PD6		6
+#define PD7		7
+
+// Reset cause, the simulator always starts with a power-on reset
+extern volatile uint8_t MCUSR;
+
+#define PORF	0
+#define EXTRF	1
+#define BORF	2
+#define WDRF	3
+
+// Timer/Counter 0
+extern volatile uint8_t TCCR0A, TCCR0B, OCR0A, OCR0B, TIMSK0, TIFR0;
+
+#define TCNT0	(*sim_tcnt0())
+
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define WGM02	3
+#define WGM00	0
+#define WGM01	1
+#define TOIE0	0
+#define OCIE0A	1
+#define OCIE0B	2
+#define TOV0	0
+#define COM0B0	4
+#define COM0B1	5
+#define COM0A0	6
+#define COM0A1	7
+
+// Timer/Counter 2, only CTC mode (WGM21) interrupts are simulated
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2, ASSR;
+
+#define CS20	0
+#define CS21	1
+#define CS22	2
+#define WGM22	3
+#define WGM20	0
+#define WGM21	1
+#define COM2B0	4
+#define COM2B1	5
+#define COM2A0	6
+#define COM2A1	7
+#define TOIE2	0
+#define OCIE2A	1
+#define OCIE2B	2
+#define TOV2	0
+#define OCF2A	1
+#define OCF2B	2
+
+// Timer/Counter 1
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+extern volatile uint16_t OCR1A, OCR1B, ICR1;
+
+#define TCNT1	(*sim_tcnt1())
+
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define WGM12	3
+#define WGM13	4
+#define WGM10	0
+#define WGM11	1
+#define TOIE1	0
+#define OCIE1A	1
+#define OCIE1B	2
+#define TOV1	0
+#define OCF1A	1
+#define OCF1B	2
+
+// Analog to digital converter. Conversions are simulated in free running mode only, on the
+// virtual clock, with a 50 Hz triangle wave plus a little noise as the input.
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern volatile uint16_t ADC;
+
+#define ADCW	ADC
+#define ADCL	(((volatile uint8_t *)&ADC)[0])
+#define ADCH	(((volatile uint8_t *)&ADC)[1])
+
+#define ADPS0	0
+#define ADPS1	1
+#define ADPS2	2
+#define ADIE	3
+#define ADIF	4
+#define ADATE	5
+#define ADSC	6
+#define ADEN	7
+#define MUX0	0
+#define MUX1	1
+#define MUX2	2
+#define MUX3	3
+#define ADLAR	5
+#define REFS0	6
+#define REFS1	7
+#define ADTS0	0
+#define ADTS1	1
+#define ADTS2	2
+#define ADC0D	0
+
+// USART 0
+extern volatile uint8_t UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+
+#define UCSR0A	(*sim_ucsr0a())
+#define UDR0	(*sim_udr0())
+
+#define MPCM0	0
+#define U2X0	1
+#define UPE0	2
+#define DOR0	3
+#define FE0		4
+#define UDRE0	5
+#define TXC0	6
+#define RXC0	7
+
+#define TXB80	0
+#define RXB80	1
+#define UCSZ02	2
+#define TXEN0	3
+#define RXEN0	4
+#define UDRIE0	5
+#define TXCIE0	6
+#define RXCIE0	7
+
+#define UCSZ00	1
+#define UCSZ01	2
+
+// SPI, on the virtual clock. The bus goes to the other board when two simulators are wired
+// together (see sim.c), otherwise what a master sends is lost and a slave receives nothing.
+extern volatile uint8_t SPCR, SPSR;
+
+#define SPDR	(*sim_spdr())
+
+#define SPR0	0
+#define SPR1	1
+#define CPHA	2
+#define CPOL	3
+#define MSTR	4
+#define DORD	5
+#define SPE		6
+#define SPIE	7
+#define SPI2X	0
+#define WCOL	6
+#define SPIF	7
+
+// Two-wire interface, master transmitter only, on the virtual clock. The bus has a PCA9685 at
+// address 0x40, which acknowledges every byte; any other address is not acknowledged.
+extern volatile uint8_t TWBR, TWSR, TWAR, TWDR;
+
+#define TWCR	(*sim_twcr())
+
+#define TWPS0	0
+#define TWPS1	1
+#define TWIE	0
+#define TWEN	2
+#define TWWC	3
+#define TWSTO	4
+#define TWSTA	5
+#define TWEA	6
+#define TWINT	7
+
+#endif // SIM_AVR_IO_H
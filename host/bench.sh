@@ -0,0 +1,97 @@
+#!/bin/sh
+# Name: bench.sh
+#
+# Replays the recorded producer timing traces in traces/ through host builds of main.c with
+# different queue lengths, consumer start watermarks, initial consume rates and log modes, and
+# compares throughput, latency percentiles and underruns against bench_baseline.txt.
+#
+# Exits with status 1 if any metric is worse than the baseline by more than the threshold.
+# The runs use the simulator's virtual clock, so they are exactly reproducible and any
+# difference from the baseline comes from a change in the code or the configuration.
+#
+# Usage: ./bench.sh [-u] [-t percent]
+#   -u  store the results as the new baseline instead of comparing
+#   -t  allowed regression in percent (default 5)
+
+cd "$(dirname "$0")" || exit 1
+
+UPDATE=0
+THRESHOLD=5
+SLACK_MS=0.1
+while getopts "ut:" opt; do
+	case $opt in
+	u) UPDATE=1 ;;
+	t) THRESHOLD=$OPTARG ;;
+	*) echo "usage: $0 [-u] [-t percent]" >&2; exit 2 ;;
+	esac
+done
+
+# One configuration per line, name:DEFS
+CONFIGS='default:
+q64:-DQUEUE_LENGTH=64
+q256:-DQUEUE_LENGTH=256
+start64:-DCONSUMER_START_LEVEL=64
+every2:-DCONSUME_EVERY=2
+deferred:-DLOG_DEFERRED'
+
+BASELINE=bench_baseline.txt
+RESULTS=build/bench_results.txt
+mkdir -p build
+: > $RESULTS
+
+echo "$CONFIGS" | while IFS=: read -r name defs; do
+	make -s BUILD="build/$name" DEFS="$defs" || exit 1
+	for trace in traces/*.trace; do
+		t=$(basename "$trace" .trace)
+		metrics=$(SIM_TRACE="$trace" SIM_QUIET=1 "build/$name/main" 2>&1 >/dev/null | tail -n 1)
+		echo "$name $t $metrics" >> $RESULTS
+		echo "$name $t $metrics"
+	done
+done || exit 1
+
+if [ $UPDATE = 1 ]; then
+	cp $RESULTS $BASELINE
+	echo "baseline updated"
+	exit 0
+fi
+
+[ -f $BASELINE ] || { echo "no $BASELINE, run $0 -u first" >&2; exit 1; }
+
+awk -v threshold="$THRESHOLD" -v slack="$SLACK_MS" '
+	function load(line, m,    i, kv) {
+		delete m
+		for (i = 3; i <= NF; i++) {
+			split($i, kv, "=")
+			m[kv[1]] = kv[2]
+		}
+	}
+	FNR == NR { load($0, b); for (k in b) base[$1 " " $2 " " k] = b[k]; next }
+	{
+		load($0, cur)
+		key = $1 " " $2
+		if (!((key " throughput") in base)) {
+			printf "%-24s new, not in baseline\n", key
+			next
+		}
+		t = threshold / 100
+		for (k in cur) {
+			old = base[key " " k]
+			if (old == "")
+				continue
+			bad = 0
+			if (k == "throughput" && cur[k] < old * (1 - t))
+				bad = 1
+			if (k ~ /_ms$/ && cur[k] > old * (1 + t) + slack)
+				bad = 1
+			if (k == "underruns" && cur[k] > old * (1 + t))
+				bad = 1
+			if (bad) {
+				printf "%-24s REGRESSION %s: %s -> %s\n", key, k, old, cur[k]
+				failed = 1
+			}
+		}
+	}
+	END { exit failed }
+' $BASELINE $RESULTS || { echo "benchmark regressed"; exit 1; }
+
+echo "no regressions (threshold ${THRESHOLD}%)"
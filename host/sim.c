@@ -0,0 +1,1250 @@
+// Name: sim.c
+//
+// Host simulator that lets main.c run unmodified on a PC, so that queue configurations can be
+// benchmarked without hardware.
+//
+// The firmware is compiled against the stand-in AVR headers in this directory. Time is counted
+// in CPU cycles and there are two clocks to choose from:
+//
+// virtual (default): a deterministic scheduler owns the cycle counter. _delay_ms(), waiting for
+//   the USART and the producer tasks being idle advance it, and interrupts (Timer 0 overflow,
+//   Timer 1 and Timer 2 compare match A, SPI transfer complete, ADC conversion complete, USART
+//   receive complete and data register empty, TWI) that fall into the advanced interval run
+//   their ISR right there, unless interrupts are disabled or an ISR is already running, in
+//   which case they stay pending. Runs are exactly reproducible and take as long
+//   as the host needs to execute the code, so a full 2^24 colour run, almost 3 days on the
+//   chip, finishes in about a minute and a half.
+//
+// real: interrupts are signals. Timer 0 is a setitimer() that raises SIGALRM at the configured
+//   overflow rate, and the handler calls TIMER0_OVF_vect(), so the ISR preempts main() at
+//   arbitrary points. Blocking SIGALRM plays the role of the I flag. The other interrupts are
+//   only simulated on the virtual clock.
+//
+// Two simulators can be wired together as two boards (see tools/pair): the bytes one sends as
+// SPI master are received by the other one's SPI slave, and each port B pin is wired to the
+// same pin of the other board: PINB reads what either board drives, or high with a pull-up on
+// either side when neither does. Both run on the virtual clock and stop every
+// SIM_LINK_CYCLES to swap what happened on their side since the last stop, which reaches the
+// other side SIM_LINK_CYCLES after it happened. MISO is not wired, the master reads 0xff.
+//
+// In both cases only a single overflow can be pending while interrupts are disabled, like the
+// TOV0 flag, and the USART transmitter takes the same time per byte as the real one at the
+// configured baud rate, which matters because printing from the ISR is what limits the
+// consumption rate.
+//
+// The output of the consumer is parsed as it is transmitted, which gives the latency of every
+// item (from the producer's enqueue to the consumer's dequeue), the throughput and the number
+// of underruns. They are reported on stderr when the run ends. Builds with LOG_DEFERRED are
+// measured the same way: their frames are expanded with the format strings linked into the
+// simulator itself, while stdout gets the raw frames, as tools/logdec would.
+//
+// Environment:
+//   SIM_CLOCK=real   use the wall clock instead of virtual time
+//   SIM_ISR_CYCLES=n cycles charged per ISR invocation on top of the code it runs, for entry,
+//                    exit and the bookkeeping (virtual clock only, default 200)
+//   SIM_FORMAT_CYCLES=n cycles charged per log line formatted with snprintf(), which the
+//                    simulator cannot time itself (virtual clock only, default 2000)
+//   SIM_TRACE=file   replay producer delays (ms, one per line) instead of random() % 16, and
+//                    stop once the trace is exhausted
+//   SIM_ITEMS=n      stop after producing n items
+//   SIM_RX=file      bytes the USART receives, "-" for stdin (virtual clock only). They arrive
+//                    at the baud rate whenever the receiver is enabled and the sender has not
+//                    been stopped with XOFF or by RTS (pin PD4 as an output, high to stop). The
+//                    run ends half a second after the last byte.
+//   SIM_RX_LAG=n     bytes the sender still sends after being stopped, like the FIFO of a USB
+//                    serial adapter (default 16)
+//   SIM_SECONDS=n    stop after n seconds of virtual time, for programs without a producer
+//                    that the other limits apply to
+//   SIM_LINK_FD=n    stream socket to the simulator of the other board, set by tools/pair
+//   SIM_LINK_CYCLES=n how often the two synchronise, and the delay of what crosses between
+//                    them (default 512, one byte at CLK_io / 64)
+//   SIM_QUIET=1      do not copy the USART output to stdout
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "avr/io.h"
+#include "util/twi.h"
+#include "../tools/logfmt.h"
+
+#define NELEMS(x) (sizeof(x)/sizeof((x)[0]))
+
+// Registers without side effects
+volatile uint8_t TCCR0A, TCCR0B, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2, ASSR;
+volatile uint8_t PINB, DDRB, PORTB, PINC, DDRC, PORTC, PIND, DDRD, PORTD;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ADC;
+volatile uint16_t OCR1A, OCR1B, ICR1;
+volatile uint8_t UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+volatile uint8_t TWBR, TWSR = TW_NO_INFO, TWAR, TWDR;
+volatile uint8_t SPCR, SPSR;
+volatile uint8_t MCUSR = (1 << PORF);
+
+// Interrupt vectors the firmware may define
+extern void TIMER0_OVF_vect(void) __attribute__((weak));
+extern void TIMER1_COMPA_vect(void) __attribute__((weak));
+extern void TIMER2_COMPA_vect(void) __attribute__((weak));
+extern void SPI_STC_vect(void) __attribute__((weak));
+extern void ADC_vect(void) __attribute__((weak));
+extern void USART_RX_vect(void) __attribute__((weak));
+extern void USART_UDRE_vect(void) __attribute__((weak));
+extern void TWI_vect(void) __attribute__((weak));
+
+// Format strings of a LOG_DEFERRED build, provided by the linker
+extern const char __start_logfmt[] __attribute__((weak));
+extern const char __stop_logfmt[] __attribute__((weak));
+
+// Latency histogram resolution and range
+#define LATENCY_BUCKET_NS 10000ULL				// 10 us
+#define LATENCY_BUCKETS 1000000					// up to 10 s
+
+// Produce timestamps are kept for this many items, which only needs to exceed the queue length
+#define PRODUCED_WINDOW 65536
+
+// Cost of one read of a status register in a polling loop
+#define POLL_CYCLES 4
+
+// Address of the PCA9685 on the TWI bus
+#define TWI_DEVICE 0x40
+
+// Events that can be outstanding on the link in each direction
+#define LINK_EVENTS 1024
+
+enum { LINK_SYNC, LINK_SPI, LINK_PORT, LINK_DDR };
+
+// What happened on one board at a given cycle, as sent to the other one
+struct link_event {
+	uint64_t at;
+	uint8_t type;				// LINK_SPI: a byte sent, LINK_PORT and LINK_DDR: a new PORTB or DDRB
+	uint8_t value;
+};
+
+static struct {
+	int virtual_clock;			// 1 for virtual time, 0 for the wall clock
+	uint64_t cycles;			// virtual time
+	uint64_t start_ns;			// wall clock at startup
+	uint64_t isr_cycles;		// fixed cost charged per ISR invocation
+	uint64_t format_cycles;		// cost charged per snprintf() in LOG()
+
+	uint8_t irq_enabled;		// mirror of the I flag
+	uint8_t in_isr;				// 1 while an ISR is running
+
+	// Timer 0
+	uint64_t timer0_period;		// overflow period in cycles, 0 while stopped
+	uint64_t timer0_next;		// cycle of the next overflow (virtual clock)
+	uint8_t tov0;				// overflow pending (virtual clock)
+	uint8_t tcnt0;
+
+	// Timer 1, counting freely since reset
+	uint16_t tcnt1;
+	uint8_t tcnt1_reads;		// reads of TCNT1 since the clock last moved (virtual clock)
+	uint8_t ocf1a;				// compare match A pending (virtual clock)
+
+	// Timer 2
+	uint64_t timer2_last;		// cycle of the last compare match A
+	uint8_t ocf2a;				// compare match A pending (virtual clock)
+
+	// ADC
+	uint64_t adc_done;			// cycle at which the current conversion completes, 0 if none
+	uint32_t adc_noise;			// noise generator state
+
+	// USART transmitter
+	uint8_t ucsr0a;
+	uint64_t tx_free;			// cycle at which the transmit buffer is empty again
+	unsigned polls;				// consecutive UCSR0A reads without any other activity
+
+	// The UDR0 slot each context was handed last, and when. Whether it was read or written is
+	// only known at the next call into the simulator from that context.
+	volatile uint16_t *udr0[2];
+	uint64_t udr0_at[2];
+
+	// USART receiver
+	int rx_fd;					// SIM_RX, -1 if none
+	uint8_t rx_buf[4096];		// read ahead from rx_fd
+	size_t rx_len, rx_pos;
+	uint8_t rx_fifo[2];			// the receive buffer, UDR0 reads the first byte
+	uint8_t rx_count;
+	uint8_t rx_dor;				// data overrun, until UDR0 is read
+	uint64_t rx_next;			// cycle at which the byte on the line is complete, 0 if none
+	unsigned rx_lag;			// bytes still sent after the sender is stopped
+	unsigned rx_late;			// of those, the ones still to come
+	uint8_t xoff;				// the sender has received XOFF
+	uint64_t rx_eof;			// cycle at which the input ran out, 0 before
+	uint64_t rx_first, rx_bytes, rx_overruns, rx_stalls;
+
+	// TWI master. TWCR is handed out as a slot like UDR0, and settled the same way.
+	uint8_t twcr;				// the register, TWINT is set by the simulator only
+	volatile uint16_t twcr_slot[2];
+	uint8_t twcr_handed[2];		// whether twcr_slot was handed to the context
+	uint64_t twcr_at[2];
+	uint64_t twi_done;			// cycle at which the bus operation completes, 0 if none
+	uint8_t twi_status;			// TWSR then, 0 for a STOP, which sets no TWINT
+	uint8_t twi_busy;			// between a START and a STOP
+	uint8_t twi_address;		// the next byte is the address
+	uint8_t twi_selected;		// the PCA9685 acknowledged its address
+	uint8_t twi_pointer;		// PCA9685 register pointer
+	uint8_t twi_has_pointer;	// the pointer has been sent in this transaction
+	uint8_t twi_registers[256];
+	uint64_t twi_first, twi_last, twi_bytes, twi_nacks;
+
+	uint64_t max_cycles;		// SIM_SECONDS, 0 for no limit
+
+	// SPI. SPDR is handed out as a slot like UDR0, and settled the same way.
+	volatile uint16_t spdr_slot[2];
+	uint8_t spdr_handed[2];
+	uint64_t spdr_at[2];
+	uint8_t spdr_in;			// last byte received
+	uint8_t spi_out;			// byte the master is sending
+	uint64_t spi_done;			// cycle at which the master's transfer completes, 0 if none
+	uint64_t spi_sent, spi_received, spi_overruns;
+
+	// Link to the other board, see above
+	int link_fd;				// -1 if none
+	uint64_t link_cycles;
+	uint64_t link_sync;			// cycle of the next synchronisation
+	struct link_event link_out[LINK_EVENTS];	// since the last synchronisation
+	unsigned link_out_count;
+	struct link_event link_in[LINK_EVENTS];		// from the other board, not yet due
+	unsigned link_in_head, link_in_count;
+	uint8_t link_port, link_ddr;	// PORTB and DDRB last sent
+	uint8_t peer_port, peer_ddr;	// the other board's
+
+	// Bytes written to UDR0, kept separately for main() and the ISR so that flushing one of
+	// them never touches a slot the other context is about to write
+	struct {
+		volatile uint16_t slot[512];
+		unsigned count;
+	} tx[2];
+
+	// Consumer output parsing (ISR context only)
+	struct logfmt_decoder decoder;
+	char line[256];
+	size_t line_len;
+
+	// Producer trace
+	uint8_t *trace;
+	size_t trace_len;
+	uint64_t max_items;
+	int quiet;
+
+	// Metrics
+	uint64_t produced;
+	uint64_t produce_at[PRODUCED_WINDOW];
+	uint64_t consumed;
+	uint64_t underruns;
+	int consume_every;
+	uint64_t first_produce;
+	uint32_t *latency;			// histogram of LATENCY_BUCKETS buckets
+	uint64_t latency_max;
+} sim;
+
+static void run_pending_isrs(void);
+
+static uint64_t ns_to_cycles(double ns) {
+	return (uint64_t)(ns * (F_CPU / 1e9));
+}
+
+static double cycles_to_ns(uint64_t cycles) {
+	return cycles * (1e9 / F_CPU);
+}
+
+static uint64_t wall_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Current time in CPU cycles
+static uint64_t now(void) {
+	if (sim.virtual_clock)
+		return sim.cycles;
+	return ns_to_cycles(wall_ns() - sim.start_ns);
+}
+
+static void block_timer(int block) {
+	if (sim.virtual_clock)
+		return;
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+// Timer 1 prescale for the clock select bits in TCCR1B, 0 if stopped
+static uint64_t timer1_prescale(void) {
+	static const uint16_t prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	return prescale[TCCR1B & 7];
+}
+
+// Cycle of the next Timer 1 compare match A, UINT64_MAX if its interrupt is off. OCR1A may be
+// written at any time, so this is worked out again whenever it is needed.
+static uint64_t timer1_compa_next(void) {
+	uint64_t prescale = timer1_prescale();
+	if (!prescale || !(TIMSK1 & (1 << OCIE1A)))
+		return UINT64_MAX;
+	uint64_t tick = sim.cycles / prescale;
+	return (tick + ((uint16_t)(OCR1A - tick - 1)) + 1) * prescale;
+}
+
+// Cycle of the next Timer 2 compare match A in CTC mode, UINT64_MAX if its interrupt is off.
+// OCR2A is the top of the count, so a new value takes effect from the next match on.
+static uint64_t timer2_compa_next(void) {
+	static const uint16_t prescale[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+	uint64_t period = (OCR2A + 1ULL) * prescale[TCCR2B & 7];
+	if (!period || !(TCCR2A & (1 << WGM21)) || !(TIMSK2 & (1 << OCIE2A)))
+		return UINT64_MAX;
+
+	// Catch up on matches that went by while the interrupt was off
+	if (sim.timer2_last + period < sim.cycles)
+		sim.timer2_last = sim.cycles - (sim.cycles - sim.timer2_last) % period;
+	return sim.timer2_last + period;
+}
+
+// Cycle at which the running ADC conversion completes, UINT64_MAX if there is none. The first
+// conversion after ADSC is set takes 25 ADC clocks, the ones after it 13.
+static uint64_t adc_next(void) {
+	static const uint8_t prescale[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+	if (!(ADCSRA & (1 << ADEN)) || !(ADCSRA & (1 << ADSC))) {
+		sim.adc_done = 0;
+		return UINT64_MAX;
+	}
+	if (!sim.adc_done)
+		sim.adc_done = sim.cycles + 25ULL * prescale[ADCSRA & 7];
+	return sim.adc_done;
+}
+
+// Completes the running conversion and starts the next one in free running mode
+static void adc_complete(void) {
+	static const uint8_t prescale[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+	uint64_t period = F_CPU / 50;
+	uint64_t phase = sim.cycles % period;
+	uint64_t triangle = phase < period / 2 ? phase : period - phase;
+
+	sim.adc_noise = sim.adc_noise * 1103515245 + 12345;
+	ADC = 112 + triangle * 1600 / period + (sim.adc_noise >> 16) % 16 - 8;
+	ADCSRA |= (1 << ADIF);
+	if (ADCSRA & (1 << ADATE))
+		sim.adc_done += 13ULL * prescale[ADCSRA & 7];
+	else
+		ADCSRA &= ~(1 << ADSC);
+}
+
+// Duration of one USART frame (start bit, 8 data bits, stop bit) at the programmed baud rate
+static uint64_t uart_byte_cycles(void) {
+	uint16_t ubrr = (UBRR0H << 8) | UBRR0L;
+	uint32_t divisor = (sim.ucsr0a & (1 << U2X0)) ? 8 : 16;
+	return 10ULL * divisor * (ubrr + 1UL);
+}
+
+// Works out what the firmware did with the UDR0 slot it was handed last
+static void settle_udr0(int isr) {
+	volatile uint16_t *slot = sim.udr0[isr];
+	if (!slot)
+		return;
+	sim.udr0[isr] = NULL;
+
+	if (*slot < 0x100) {
+		// Written: the transmit buffer is busy for one frame from then, or from the end of the
+		// current one
+		uint64_t t = sim.udr0_at[isr];
+		sim.tx_free = (sim.tx_free > t ? sim.tx_free : t) + uart_byte_cycles();
+		if (*slot == 0x13)
+			sim.xoff = 1;
+		else if (*slot == 0x11)
+			sim.xoff = 0;
+	} else if (sim.rx_count) {
+		// Read: the next byte in the receive buffer moves up
+		sim.rx_fifo[0] = sim.rx_fifo[1];
+		sim.rx_count--;
+		sim.rx_dor = 0;
+	}
+}
+
+// The sender has been told to stop, with XOFF or RTS
+static int rx_stopped(void) {
+	return sim.xoff || ((DDRD & (1 << PD4)) && (PORTD & (1 << PD4)));
+}
+
+// Cycle at which the byte on the line is complete, UINT64_MAX if the line is idle
+static uint64_t rx_next(void) {
+	if (sim.rx_fd < 0 || sim.rx_eof || !(UCSR0B & (1 << RXEN0)))
+		return UINT64_MAX;
+	if (!sim.rx_next) {
+		if (rx_stopped())
+			return UINT64_MAX;
+		sim.rx_late = sim.rx_lag;
+		sim.rx_next = sim.cycles + uart_byte_cycles();
+	}
+	return sim.rx_next;
+}
+
+// Next byte of SIM_RX, -1 at the end
+static int rx_read(void) {
+	if (sim.rx_pos == sim.rx_len) {
+		ssize_t n;
+		while ((n = read(sim.rx_fd, sim.rx_buf, sizeof(sim.rx_buf))) < 0 && errno == EINTR)
+			;
+		if (n <= 0)
+			return -1;
+		sim.rx_len = n;
+		sim.rx_pos = 0;
+	}
+	return sim.rx_buf[sim.rx_pos++];
+}
+
+// A byte has come in, and unless the sender was stopped the next one follows right away
+static void rx_complete(void) {
+	int c = rx_read();
+	if (c < 0) {
+		sim.rx_eof = sim.cycles;
+		sim.rx_next = 0;
+		return;
+	}
+
+	if (!sim.rx_bytes++)
+		sim.rx_first = sim.cycles;
+	if (sim.rx_count < NELEMS(sim.rx_fifo)) {
+		sim.rx_fifo[sim.rx_count++] = c;
+	} else {
+		sim.rx_dor = 1;
+		sim.rx_overruns++;
+	}
+
+	if (rx_stopped()) {
+		if (!sim.rx_late) {
+			sim.rx_next = 0;
+			sim.rx_stalls++;
+			return;
+		}
+		sim.rx_late--;
+	}
+	sim.rx_next += uart_byte_cycles();
+}
+
+// One SCL period for the bit rate and prescaler in TWBR and TWSR
+static uint64_t twi_bit_cycles(void) {
+	return 16 + 2ULL * TWBR * (1 << (2 * (TWSR & 3)));
+}
+
+// A data byte the PCA9685 received: the register pointer first, then register values, with
+// the pointer moving on if MODE1 has auto increment on
+static void twi_device_byte(uint8_t byte) {
+	if (!sim.twi_has_pointer) {
+		sim.twi_pointer = byte;
+		sim.twi_has_pointer = 1;
+		return;
+	}
+	sim.twi_registers[sim.twi_pointer] = byte;
+	if (sim.twi_registers[0] & 0x20)
+		sim.twi_pointer++;
+}
+
+// The firmware wrote TWCR at cycle t. Writing TWINT clears the flag and starts what the other
+// bits ask for: a START, a STOP, both (STOP then START), or else sending TWDR.
+static void twi_write(uint8_t value, uint64_t t) {
+	if (!(value & (1 << TWEN))) {
+		sim.twcr = value & ~(1 << TWINT);
+		sim.twi_done = 0;
+		sim.twi_busy = 0;
+		return;
+	}
+	if (!(value & (1 << TWINT))) {
+		sim.twcr = (sim.twcr & (1 << TWINT)) | value;
+		return;
+	}
+	sim.twcr = value & ~(1 << TWINT);
+
+	// A STOP may still be on the bus when the next START is asked for
+	uint64_t start = sim.twi_done > t ? sim.twi_done : t;
+	uint64_t bits;
+	if (value & (1 << TWSTA)) {
+		bits = (value & (1 << TWSTO)) ? 2 : 1;
+		sim.twi_status = sim.twi_busy && !(value & (1 << TWSTO)) ? TW_REP_START : TW_START;
+		sim.twi_busy = 1;
+		sim.twi_address = 1;
+	} else if (value & (1 << TWSTO)) {
+		bits = 1;
+		sim.twi_status = 0;
+		sim.twi_busy = 0;
+	} else {
+		bits = 9;
+		if (sim.twi_address) {
+			sim.twi_address = 0;
+			sim.twi_selected = TWDR == ((TWI_DEVICE << 1) | TW_WRITE);
+			sim.twi_has_pointer = 0;
+			sim.twi_status = sim.twi_selected ? TW_MT_SLA_ACK : TW_MT_SLA_NACK;
+		} else if (sim.twi_selected) {
+			twi_device_byte(TWDR);
+			sim.twi_status = TW_MT_DATA_ACK;
+		} else {
+			sim.twi_status = TW_MT_DATA_NACK;
+		}
+		if (sim.twi_status == TW_MT_SLA_NACK || sim.twi_status == TW_MT_DATA_NACK)
+			sim.twi_nacks++;
+		if (!sim.twi_bytes++)
+			sim.twi_first = start;
+		sim.twi_last = start + bits * twi_bit_cycles();
+	}
+	sim.twi_done = start + bits * twi_bit_cycles();
+}
+
+// The bus operation is over: TWINT is set with the new status, or the STOP bit cleared
+static void twi_complete(void) {
+	sim.twi_done = 0;
+	sim.twcr &= ~(1 << TWSTO);
+	if (sim.twi_status) {
+		sim.twcr |= (1 << TWINT);
+		TWSR = sim.twi_status | (TWSR & 3);
+	} else {
+		TWSR = TW_NO_INFO | (TWSR & 3);
+	}
+}
+
+// Works out whether the firmware wrote the TWCR slot it was handed last
+static void settle_twcr(int isr) {
+	if (!sim.twcr_handed[isr])
+		return;
+	sim.twcr_handed[isr] = 0;
+	if (sim.twcr_slot[isr] < 0x100)
+		twi_write(sim.twcr_slot[isr], sim.twcr_at[isr]);
+}
+
+// Cycles per byte for the clock rate bits in SPCR and SPSR
+static uint64_t spi_byte_cycles(void) {
+	static const uint8_t divider[4] = { 4, 16, 64, 128 };
+	return 8ULL * divider[SPCR & 3] / ((SPSR & (1 << SPI2X)) ? 2 : 1);
+}
+
+static void link_send(uint8_t type, uint8_t value) {
+	if (sim.link_fd < 0)
+		return;
+	if (sim.link_out_count == LINK_EVENTS) {
+		fprintf(stderr, "sim: too many link events, lower SIM_LINK_CYCLES\n");
+		exit(1);
+	}
+	sim.link_out[sim.link_out_count++] = (struct link_event){ sim.cycles, type, value };
+}
+
+// The firmware wrote SPDR at cycle t. A master starts sending it, unless a transfer is still
+// going on, which is a write collision. A slave would send it with the next byte it receives,
+// but MISO is not wired.
+static void spi_write(uint8_t value, uint64_t t) {
+	if (!(SPCR & (1 << SPE)) || !(SPCR & (1 << MSTR)))
+		return;
+	if (sim.spi_done) {
+		SPSR |= (1 << WCOL);
+		return;
+	}
+	sim.spi_out = value;
+	sim.spi_done = t + spi_byte_cycles();
+}
+
+// The master's transfer is over, and the byte goes to the other board
+static void spi_complete(void) {
+	sim.spi_done = 0;
+	sim.spdr_in = 0xff;
+	SPSR |= (1 << SPIF);
+	sim.spi_sent++;
+	link_send(LINK_SPI, sim.spi_out);
+}
+
+// A byte from the other board's master. One that comes in before the previous one was read
+// replaces it.
+static void spi_receive(uint8_t value) {
+	if (!(SPCR & (1 << SPE)) || (SPCR & (1 << MSTR)))
+		return;
+	if (SPSR & (1 << SPIF))
+		sim.spi_overruns++;
+	sim.spdr_in = value;
+	SPSR |= (1 << SPIF);
+	sim.spi_received++;
+}
+
+static void settle_spdr(int isr) {
+	if (!sim.spdr_handed[isr])
+		return;
+	sim.spdr_handed[isr] = 0;
+	SPSR &= ~((1 << SPIF) | (1 << WCOL));
+	if (sim.spdr_slot[isr] < 0x100)
+		spi_write(sim.spdr_slot[isr], sim.spdr_at[isr]);
+}
+
+static void link_io(int write_side, void *buf, size_t len) {
+	char *p = buf;
+	while (len) {
+		ssize_t n = write_side ? write(sim.link_fd, p, len) : read(sim.link_fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			exit(0);		// the other board has stopped
+		p += n;
+		len -= n;
+	}
+}
+
+// Cycle of the next thing to do on the link, UINT64_MAX without one
+static uint64_t link_next(void) {
+	if (sim.link_fd < 0)
+		return UINT64_MAX;
+	if (sim.link_in_count && sim.link_in[sim.link_in_head].at < sim.link_sync)
+		return sim.link_in[sim.link_in_head].at;
+	return sim.link_sync;
+}
+
+// What the pins wired to the other board read
+static void link_pins(void) {
+	uint8_t pulled = (PORTB & ~DDRB) | (sim.peer_port & ~sim.peer_ddr);
+	uint8_t driven = (PORTB & DDRB) | (sim.peer_port & sim.peer_ddr);
+	PINB = driven | (pulled & ~(DDRB | sim.peer_ddr));
+}
+
+// Hands what the other board did to the peripherals once it is due, and swaps the events of
+// the last SIM_LINK_CYCLES at every synchronisation
+static void link_step(void) {
+	while (sim.link_in_count && sim.link_in[sim.link_in_head].at <= sim.cycles) {
+		struct link_event *e = &sim.link_in[sim.link_in_head];
+		if (e->type == LINK_SPI)
+			spi_receive(e->value);
+		else {
+			if (e->type == LINK_PORT)
+				sim.peer_port = e->value;
+			else
+				sim.peer_ddr = e->value;
+			link_pins();
+		}
+		sim.link_in_head = (sim.link_in_head + 1) % LINK_EVENTS;
+		sim.link_in_count--;
+	}
+	if (sim.cycles < sim.link_sync)
+		return;
+
+	link_pins();
+	if (PORTB != sim.link_port) {
+		sim.link_port = PORTB;
+		link_send(LINK_PORT, PORTB);
+	}
+	if (DDRB != sim.link_ddr) {
+		sim.link_ddr = DDRB;
+		link_send(LINK_DDR, DDRB);
+	}
+	link_send(LINK_SYNC, 0);
+	link_io(1, sim.link_out, sim.link_out_count * sizeof(struct link_event));
+	sim.link_out_count = 0;
+
+	// The other board's events up to its LINK_SYNC, which arrive one period later
+	for (;;) {
+		struct link_event e;
+		link_io(0, &e, sizeof(e));
+		if (e.type == LINK_SYNC)
+			break;
+		if (sim.link_in_count == LINK_EVENTS) {
+			fprintf(stderr, "sim: too many link events, lower SIM_LINK_CYCLES\n");
+			exit(1);
+		}
+		e.at += sim.link_cycles;
+		sim.link_in[(sim.link_in_head + sim.link_in_count++) % LINK_EVENTS] = e;
+	}
+	sim.link_sync += sim.link_cycles;
+}
+
+// Cycle at which the transmit buffer becomes empty with its interrupt on, UINT64_MAX if that is
+// not ahead. An empty buffer is already pending and taken care of by run_pending_isrs().
+static uint64_t udre_next(void) {
+	if (!(UCSR0B & (1 << UDRIE0)) || sim.tx_free <= sim.cycles)
+		return UINT64_MAX;
+	return sim.tx_free;
+}
+
+// Lets the given number of cycles of the current context pass on the virtual clock. Timer
+// events that fall into this interval run their ISR right away if interrupts are enabled, and
+// the time spent there comes on top, just like an ISR stretches a busy wait on the real chip.
+static void advance(uint64_t cycles) {
+	sim.tcnt1_reads = 0;
+	settle_udr0(sim.in_isr);
+	settle_twcr(sim.in_isr);
+	settle_spdr(sim.in_isr);
+	if (sim.link_fd >= 0)
+		link_pins();
+	while (cycles) {
+		uint64_t timer0 = sim.timer0_period ? sim.timer0_next : UINT64_MAX;
+		uint64_t compa = timer1_compa_next();
+		uint64_t compa2 = timer2_compa_next();
+		uint64_t adc = adc_next();
+		uint64_t rx = rx_next();
+		uint64_t udre = udre_next();
+		uint64_t twi = sim.twi_done ? sim.twi_done : UINT64_MAX;
+		uint64_t spi = sim.spi_done ? sim.spi_done : UINT64_MAX;
+		uint64_t link = link_next();
+		uint64_t next = timer0 < compa ? timer0 : compa;
+		if (compa2 < next)
+			next = compa2;
+		if (adc < next)
+			next = adc;
+		if (rx < next)
+			next = rx;
+		if (udre < next)
+			next = udre;
+		if (twi < next)
+			next = twi;
+		if (spi < next)
+			next = spi;
+		if (link < next)
+			next = link;
+		if (sim.cycles + cycles < next) {
+			sim.cycles += cycles;
+			break;
+		}
+		cycles -= next - sim.cycles;
+		sim.cycles = next;
+		if (next == timer0) {
+			sim.timer0_next += sim.timer0_period;
+			sim.tov0 = 1;
+		}
+		if (next == compa)
+			sim.ocf1a = 1;
+		if (next == compa2) {
+			sim.timer2_last = next;
+			sim.ocf2a = 1;
+		}
+		if (next == adc)
+			adc_complete();
+		if (next == rx)
+			rx_complete();
+		if (next == twi)
+			twi_complete();
+		if (next == spi)
+			spi_complete();
+		if (next == link)
+			link_step();
+		run_pending_isrs();
+	}
+
+	if (sim.rx_eof && sim.cycles - sim.rx_eof >= F_CPU / 2)
+		exit(0);
+	if (sim.max_cycles && sim.cycles >= sim.max_cycles)
+		exit(0);
+}
+
+// Parses "(r, g, b) consuming every: n" without sscanf(), which would dominate long runs.
+// Returns the number of fields found.
+static int parse_consumed(const char *p, long field[4]) {
+	int n = 0;
+	while (n < 4 && *p) {
+		if (*p >= '0' && *p <= '9') {
+			char *end;
+			field[n++] = strtol(p, &end, 10);
+			p = end;
+		} else {
+			p++;
+		}
+	}
+	return n;
+}
+
+// With several producers the consumer appends "queue: n" to its lines, only queue 0 is measured
+static int queue_zero(const char *line) {
+	const char *p = strstr(line, "queue: ");
+	return !p || atoi(p + 7) == 0;
+}
+
+// Consumer output, one complete line at a time
+static void parse_line(const char *line) {
+	const char *p;
+	int every;
+
+	if (line[0] == '<' && (p = strstr(line, "Consumed")) && (p = strchr(p, '('))) {
+		long field[4];
+		int n = parse_consumed(p, field);
+		if (n < 3 || !queue_zero(line))
+			return;
+		if (n == 4 && strstr(line, "consuming every"))
+			sim.consume_every = field[3];
+		long r = field[0], g = field[1], b = field[2];
+
+		// The producer walks through the colours in order, so the colour is the item number
+		uint64_t id = ((uint64_t)r << 16) | (g << 8) | b;
+		uint64_t t = now();
+		uint64_t produced_at = t;
+
+		// Find the most recent production of this colour, it may have wrapped around
+		uint64_t produced = sim.produced;
+		if (produced) {
+			uint64_t newest = produced - 1;
+			uint64_t item = newest - ((newest - id) & 0xffffff);
+			if (item <= newest && newest - item < PRODUCED_WINDOW)
+				produced_at = sim.produce_at[item % PRODUCED_WINDOW];
+		}
+
+		uint64_t latency = t > produced_at ? t - produced_at : 0;
+		uint64_t bucket = cycles_to_ns(latency) / LATENCY_BUCKET_NS;
+		sim.latency[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+		if (latency > sim.latency_max)
+			sim.latency_max = latency;
+		sim.consumed++;
+	} else if (sscanf(line, "Queue is empty! Increased consume_every to: %d", &every) == 1 &&
+			   queue_zero(line)) {
+		sim.consume_every = every;
+		sim.underruns++;
+	}
+}
+
+static void parse_char(char c) {
+	if (c == '\n') {
+		sim.line[sim.line_len] = '\0';
+		parse_line(sim.line);
+		sim.line_len = 0;
+	} else if (sim.line_len < sizeof(sim.line) - 1) {
+		sim.line[sim.line_len++] = c;
+	}
+}
+
+static void flush_tx(int isr) {
+	char out[NELEMS(sim.tx[0].slot)];
+	size_t len = 0;
+
+	settle_udr0(isr);
+	if (!sim.tx[isr].count)
+		return;
+
+	for (unsigned i = 0; i < sim.tx[isr].count; i++) {
+		uint16_t v = sim.tx[isr].slot[i];
+		if (v < 0x100)
+			out[len++] = v;
+	}
+	sim.tx[isr].count = 0;
+
+	if (len && !sim.quiet) {
+		ssize_t done = 0;
+		while (done < (ssize_t)len) {
+			ssize_t n = write(STDOUT_FILENO, out + done, len - done);
+			if (n < 0 && errno != EINTR)
+				break;
+			if (n > 0)
+				done += n;
+		}
+	}
+
+	// Only the consumer's output is measured
+	if (!isr)
+		return;
+	for (size_t i = 0; i < len; i++) {
+		char text[256];
+		int r = logfmt_feed(&sim.decoder, out[i], text, sizeof(text));
+		if (r < 0)
+			parse_char(out[i]);
+		for (char *p = text; r > 0 && *p; p++)
+			parse_char(*p);
+	}
+}
+
+volatile uint8_t *sim_ucsr0a(void) {
+	flush_tx(sim.in_isr);
+
+	// A read that follows another read is a polling loop, which on the virtual clock skips
+	// straight to the moment the transmitter becomes ready or the next byte comes in
+	if (sim.virtual_clock) {
+		uint64_t change = sim.cycles < sim.tx_free ? sim.tx_free : UINT64_MAX;
+		uint64_t rx = rx_next();
+		if (rx < change)
+			change = rx;
+		if (sim.polls++ && change != UINT64_MAX)
+			advance(change - sim.cycles);
+		else
+			advance(POLL_CYCLES);
+	}
+
+	if (now() >= sim.tx_free)
+		sim.ucsr0a |= (1 << UDRE0);
+	else
+		sim.ucsr0a &= ~(1 << UDRE0);
+	if (sim.rx_count)
+		sim.ucsr0a |= (1 << RXC0);
+	else
+		sim.ucsr0a &= ~(1 << RXC0);
+	if (sim.rx_dor)
+		sim.ucsr0a |= (1 << DOR0);
+	else
+		sim.ucsr0a &= ~(1 << DOR0);
+	return &sim.ucsr0a;
+}
+
+// Reading the slot gives the received byte, writing it transmits one. Which of the two it was
+// is settled at the next call, see settle_udr0().
+volatile uint16_t *sim_udr0(void) {
+	int isr = sim.in_isr;
+	settle_udr0(isr);
+	if (sim.tx[isr].count == NELEMS(sim.tx[isr].slot))
+		flush_tx(isr);
+	sim.polls = 0;
+
+	volatile uint16_t *slot = &sim.tx[isr].slot[sim.tx[isr].count++];
+	*slot = 0x100 | sim.rx_fifo[0];
+	sim.udr0[isr] = slot;
+	sim.udr0_at[isr] = now();
+	return slot;
+}
+
+// Reading the slot gives TWCR, writing it starts a bus operation. Which of the two it was is
+// settled at the next call, see settle_twcr().
+volatile uint16_t *sim_twcr(void) {
+	int isr = sim.in_isr;
+	settle_twcr(isr);
+	sim.polls = 0;
+	if (sim.virtual_clock)
+		advance(POLL_CYCLES);
+
+	sim.twcr_slot[isr] = 0x100 | sim.twcr;
+	sim.twcr_handed[isr] = 1;
+	sim.twcr_at[isr] = now();
+	return &sim.twcr_slot[isr];
+}
+
+// Reading the slot gives the received byte, writing it sends one. Which of the two it was is
+// settled at the next call, see settle_spdr().
+volatile uint16_t *sim_spdr(void) {
+	int isr = sim.in_isr;
+	settle_spdr(isr);
+	sim.polls = 0;
+
+	sim.spdr_slot[isr] = 0x100 | sim.spdr_in;
+	sim.spdr_handed[isr] = 1;
+	sim.spdr_at[isr] = now();
+	return &sim.spdr_slot[isr];
+}
+
+// Timer 0 overflow period in cycles for the clock select bits in TCCR0B, 0 if stopped
+static uint64_t timer0_period(void) {
+	static const uint16_t prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	return 256ULL * prescale[TCCR0B & 7];
+}
+
+// Picks up prescaler changes made by the firmware
+static void arm_timer0(void) {
+	uint64_t period = timer0_period();
+	if (period == sim.timer0_period)
+		return;
+
+	if (sim.virtual_clock) {
+		if (!sim.timer0_period)
+			sim.timer0_next = sim.cycles + period;
+	} else {
+		double ns = cycles_to_ns(period);
+		struct itimerval it = { { 0, 0 }, { 0, 0 } };
+		it.it_interval.tv_sec = ns / 1e9;
+		it.it_interval.tv_usec = (uint64_t)(ns / 1e3) % 1000000;
+		it.it_value = it.it_interval;
+		setitimer(ITIMER_REAL, &it, NULL);
+	}
+	sim.timer0_period = period;
+}
+
+static void run_isr(void (*vect)(void)) {
+	if (!vect)
+		return;
+
+	// The I flag is cleared on entry and set again by reti
+	sim.in_isr = 1;
+	sim.irq_enabled = 0;
+	sim.polls = 0;
+	if (sim.virtual_clock)
+		advance(sim.isr_cycles);
+	vect();
+	settle_twcr(1);
+	settle_spdr(1);
+	flush_tx(1);
+	sim.irq_enabled = 1;
+	sim.in_isr = 0;
+}
+
+static void run_timer0_isr(void) {
+	if (TIMSK0 & (1 << TOIE0))
+		run_isr(TIMER0_OVF_vect);
+}
+
+// Virtual clock: run whatever became pending, for as long as something is pending, in the
+// order of the interrupt vector table
+static void run_pending_isrs(void) {
+	while (sim.irq_enabled && !sim.in_isr) {
+		if (sim.ocf2a && (TIMSK2 & (1 << OCIE2A))) {
+			sim.ocf2a = 0;
+			run_isr(TIMER2_COMPA_vect);
+		} else if (sim.ocf1a && (TIMSK1 & (1 << OCIE1A))) {
+			sim.ocf1a = 0;
+			run_isr(TIMER1_COMPA_vect);
+		} else if (sim.tov0 && (TIMSK0 & (1 << TOIE0))) {
+			sim.tov0 = 0;
+			run_timer0_isr();
+		} else if ((SPSR & (1 << SPIF)) && (SPCR & (1 << SPIE)) && SPI_STC_vect) {
+			SPSR &= ~(1 << SPIF);		// cleared by hardware when the ISR runs
+			run_isr(SPI_STC_vect);
+		} else if (sim.rx_count && (UCSR0B & (1 << RXCIE0))) {
+			run_isr(USART_RX_vect);
+		} else if (sim.cycles >= sim.tx_free && (UCSR0B & (1 << UDRIE0)) && USART_UDRE_vect) {
+			run_isr(USART_UDRE_vect);
+		} else if ((ADCSRA & (1 << ADIF)) && (ADCSRA & (1 << ADIE))) {
+			ADCSRA &= ~(1 << ADIF);		// cleared by hardware when the ISR runs
+			run_isr(ADC_vect);
+		} else if ((sim.twcr & (1 << TWINT)) && (sim.twcr & (1 << TWIE)) && TWI_vect) {
+			run_isr(TWI_vect);		// TWINT stays set until the ISR writes it
+		} else {
+			break;
+		}
+	}
+}
+
+// Real clock: SIGALRM is blocked while we are in here, which is the I flag being cleared
+static void on_timer(int sig) {
+	(void)sig;
+	run_timer0_isr();
+}
+
+void sim_sei(void) {
+	arm_timer0();
+	sim.irq_enabled = 1;
+	if (!sim.in_isr) {
+		block_timer(0);
+		if (sim.virtual_clock)
+			run_pending_isrs();
+	}
+}
+
+void sim_cli(void) {
+	if (!sim.in_isr)
+		block_timer(1);
+	sim.irq_enabled = 0;
+}
+
+uint8_t sim_irq_enabled(void) {
+	return sim.irq_enabled;
+}
+
+void sim_delay_us(double us) {
+	flush_tx(sim.in_isr);
+	sim.polls = 0;
+
+	if (sim.virtual_clock) {
+		advance(ns_to_cycles(us * 1000.0));
+		return;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t ns = ts.tv_nsec + (uint64_t)(us * 1000.0);
+	ts.tv_sec += ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+void sim_format(void) {
+	if (sim.virtual_clock)
+		advance(sim.format_cycles);
+}
+
+// Counts up to the next overflow, which is all the firmware reads it for
+volatile uint8_t *sim_tcnt0(void) {
+	uint64_t period = timer0_period();
+	if (period && sim.virtual_clock && sim.timer0_period)
+		sim.tcnt0 = (sim.cycles + sim.timer0_period - sim.timer0_next) / (period / 256);
+	else if (period)
+		sim.tcnt0 = now() / (period / 256);
+	return &sim.tcnt0;
+}
+
+// Reading TCNT1 lets no time pass on the virtual clock, the scheduler reads it twice per pass
+// and a full advance() each time made it the slowest part of a run. Only a third read without
+// time passing in between, a loop that waits for it to change, moves the clock on.
+volatile uint16_t *sim_tcnt1(void) {
+	if (sim.virtual_clock && ++sim.tcnt1_reads > 2)
+		advance(POLL_CYCLES);
+
+	uint64_t prescale = timer1_prescale();
+	if (prescale)
+		sim.tcnt1 = now() / prescale;
+	return &sim.tcnt1;
+}
+
+void sim_idle(uint16_t ticks) {
+	flush_tx(sim.in_isr);
+	sim.polls = 0;
+
+	// Nothing main() is waiting for happens before TCNT1 has counted this far
+	uint64_t prescale = timer1_prescale();
+	uint64_t t = now();
+	uint64_t until = prescale ? (t / prescale + ticks) * prescale : t + POLL_CYCLES;
+	if (sim.virtual_clock)
+		advance(until - t);
+	else
+		sim_delay_us(cycles_to_ns(until - t) / 1e3);
+}
+
+static double percentile_ms(double p) {
+	uint64_t rank = (uint64_t)(p * sim.consumed);
+	uint64_t seen = 0;
+	if (rank >= sim.consumed)
+		rank = sim.consumed - 1;
+	for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += sim.latency[i];
+		if (seen > rank)
+			return (i + 0.5) * LATENCY_BUCKET_NS / 1e6;
+	}
+	return 0;
+}
+
+static void report(void) {
+	block_timer(1);
+	flush_tx(0);
+
+	double elapsed = cycles_to_ns(now() - sim.first_produce) / 1e9;
+	fprintf(stderr, "items=%llu throughput=%.2f", (unsigned long long)sim.consumed,
+			elapsed > 0 ? sim.consumed / elapsed : 0.0);
+	if (sim.consumed)
+		fprintf(stderr, " p50_ms=%.3f p90_ms=%.3f p99_ms=%.3f max_ms=%.3f",
+				percentile_ms(0.50), percentile_ms(0.90), percentile_ms(0.99),
+				cycles_to_ns(sim.latency_max) / 1e6);
+	fprintf(stderr, " underruns=%llu every=%d\n", (unsigned long long)sim.underruns,
+			sim.consume_every);
+
+	if (sim.rx_fd >= 0) {
+		uint64_t end = sim.rx_eof ? sim.rx_eof : now();
+		double rx_elapsed = cycles_to_ns(end - sim.rx_first) / 1e9;
+		fprintf(stderr, "rx_bytes=%llu rx_rate=%.0f rx_overruns=%llu rx_stalls=%llu\n",
+				(unsigned long long)sim.rx_bytes, rx_elapsed > 0 ? sim.rx_bytes / rx_elapsed : 0.0,
+				(unsigned long long)sim.rx_overruns, (unsigned long long)sim.rx_stalls);
+	}
+
+	if (sim.link_fd >= 0)
+		fprintf(stderr, "spi_sent=%llu spi_received=%llu spi_overruns=%llu\n",
+				(unsigned long long)sim.spi_sent, (unsigned long long)sim.spi_received,
+				(unsigned long long)sim.spi_overruns);
+
+	if (sim.twi_bytes) {
+		double twi_elapsed = cycles_to_ns(sim.twi_last - sim.twi_first) / 1e9;
+		fprintf(stderr, "twi_bytes=%llu twi_rate=%.0f twi_nacks=%llu\n",
+				(unsigned long long)sim.twi_bytes,
+				twi_elapsed > 0 ? sim.twi_bytes / twi_elapsed : 0.0,
+				(unsigned long long)sim.twi_nacks);
+	}
+}
+
+uint8_t sim_producer_delay_ms(uint8_t q) {
+	sim.polls = 0;
+	if (q)
+		return random() % 16;
+
+	// Called right after the enqueue, so this is when the item was produced
+	uint64_t item = sim.produced;
+	uint64_t t = now();
+	if (!item)
+		sim.first_produce = t;
+	sim.produce_at[item % PRODUCED_WINDOW] = t;
+	sim.produced = item + 1;
+
+	if (sim.trace) {
+		if (item >= sim.trace_len)
+			exit(0);
+		return sim.trace[item];
+	}
+	if (sim.max_items && sim.produced >= sim.max_items)
+		exit(0);
+	return random() % 16;
+}
+
+static void load_trace(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "sim: %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	size_t cap = 1024;
+	sim.trace = malloc(cap);
+	char line[64];
+	while (fgets(line, sizeof(line), f)) {
+		char *end;
+		long ms = strtol(line, &end, 10);
+		if (end == line || line[0] == '#')
+			continue;
+		if (ms < 0 || ms > 255) {
+			fprintf(stderr, "sim: %s: delay %ld out of range\n", path, ms);
+			exit(1);
+		}
+		if (sim.trace_len == cap)
+			sim.trace = realloc(sim.trace, cap *= 2);
+		sim.trace[sim.trace_len++] = ms;
+	}
+	fclose(f);
+}
+
+// Runs before main(): the AVR starts with interrupts disabled
+__attribute__((constructor))
+static void sim_init(void) {
+	sim.start_ns = wall_ns();
+	sim.virtual_clock = 1;
+	sim.isr_cycles = 200;
+	sim.format_cycles = 2000;
+	if (__start_logfmt) {
+		sim.decoder.table = __start_logfmt;
+		sim.decoder.table_size = __stop_logfmt - __start_logfmt;
+	}
+	sim.ucsr0a = (1 << UDRE0);
+	sim.rx_fd = -1;
+	sim.link_fd = -1;
+	sim.link_cycles = 512;
+	sim.rx_lag = 16;
+	sim.latency = calloc(LATENCY_BUCKETS, sizeof(*sim.latency));
+
+	const char *env;
+	if ((env = getenv("SIM_CLOCK")))
+		sim.virtual_clock = strcmp(env, "real") != 0;
+	if ((env = getenv("SIM_ISR_CYCLES")))
+		sim.isr_cycles = strtoull(env, NULL, 10);
+	if ((env = getenv("SIM_FORMAT_CYCLES")))
+		sim.format_cycles = strtoull(env, NULL, 10);
+	if ((env = getenv("SIM_TRACE")))
+		load_trace(env);
+	if ((env = getenv("SIM_ITEMS")))
+		sim.max_items = strtoull(env, NULL, 10);
+	if ((env = getenv("SIM_SECONDS")))
+		sim.max_cycles = strtod(env, NULL) * F_CPU;
+	if ((env = getenv("SIM_LINK_CYCLES")))
+		sim.link_cycles = strtoull(env, NULL, 10);
+	if ((env = getenv("SIM_LINK_FD"))) {
+		sim.link_fd = atoi(env);
+		sim.link_sync = sim.link_cycles;
+	}
+	if ((env = getenv("SIM_QUIET")))
+		sim.quiet = atoi(env);
+	if ((env = getenv("SIM_RX"))) {
+		sim.rx_fd = strcmp(env, "-") == 0 ? STDIN_FILENO : open(env, O_RDONLY);
+		if (sim.rx_fd < 0) {
+			fprintf(stderr, "sim: %s: %s\n", env, strerror(errno));
+			exit(1);
+		}
+	}
+	if ((env = getenv("SIM_RX_LAG")))
+		sim.rx_lag = strtoul(env, NULL, 10);
+
+	if (!sim.virtual_clock) {
+		block_timer(1);
+
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = on_timer;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGALRM, &sa, NULL);
+	}
+
+	atexit(report);
+}
@@ -0,0 +1,43 @@
+// Name: sim.h
+//
+// Hooks between main.c and the host simulator in sim.c. This header is force-included (gcc
+// -include) ahead of the firmware source, so anything defined here takes precedence over the
+// defaults in main.c.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+// USART, TWI and SPI registers that need to behave like hardware, see avr/io.h
+volatile uint8_t *sim_ucsr0a(void);
+volatile uint16_t *sim_udr0(void);
+volatile uint16_t *sim_twcr(void);
+volatile uint16_t *sim_spdr(void);
+
+// Global interrupt flag
+void sim_sei(void);
+void sim_cli(void);
+uint8_t sim_irq_enabled(void);
+
+// Busy wait, used by _delay_ms() and _delay_us()
+void sim_delay_us(double us);
+
+// A log line was formatted with snprintf(), see log.h
+void sim_format(void);
+#define LOG_FORMAT_HOOK() sim_format()
+
+// Timer 0 and Timer 1 counters, see avr/io.h
+volatile uint8_t *sim_tcnt0(void);
+volatile uint16_t *sim_tcnt1(void);
+
+// The scheduler in sched.h has nothing to do for the given number of Timer 1 ticks
+void sim_idle(uint16_t ticks);
+#define SCHED_IDLE(ticks) sim_idle(ticks)
+
+// Producer timing, either replayed from a trace or the firmware's own random delays. Only the
+// producer of queue 0 is measured.
+uint8_t sim_producer_delay_ms(uint8_t q);
+#define PRODUCER_DELAY_MS(q) sim_producer_delay_ms(q)
+
+#endif // SIM_H
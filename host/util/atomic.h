@@ -0,0 +1,40 @@
+// Name: util/atomic.h
+//
+// Host stand-in for avr-libc's <util/atomic.h>, built the same way on top of the simulated
+// global interrupt flag.
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include <stdint.h>
+#include "sim.h"
+
+static inline uint8_t sim_cli_ret(void) {
+	sim_cli();
+	return 1;
+}
+
+static inline void sim_irq_restore(const uint8_t *enabled) {
+	if (*enabled)
+		sim_sei();
+}
+
+static inline void sim_irq_force_on(const uint8_t *unused) {
+	(void)unused;
+	sim_sei();
+}
+
+static inline void sim_irq_force_off(const uint8_t *unused) {
+	(void)unused;
+	sim_cli();
+}
+
+#define ATOMIC_RESTORESTATE uint8_t sim_sreg_save __attribute__((__cleanup__(sim_irq_restore))) = sim_irq_enabled()
+#define ATOMIC_FORCEON uint8_t sim_sreg_save __attribute__((__cleanup__(sim_irq_force_on))) = 0
+#define NONATOMIC_RESTORESTATE uint8_t sim_sreg_save __attribute__((__cleanup__(sim_irq_restore))) = sim_irq_enabled()
+#define NONATOMIC_FORCEOFF uint8_t sim_sreg_save __attribute__((__cleanup__(sim_irq_force_off))) = 0
+
+#define ATOMIC_BLOCK(type) for (type, sim_todo = sim_cli_ret(); sim_todo; sim_todo = 0)
+#define NONATOMIC_BLOCK(type) for (type, sim_todo = (sim_sei(), 1); sim_todo; sim_todo = 0)
+
+#endif // SIM_UTIL_ATOMIC_H
@@ -0,0 +1,18 @@
+// Name: util/delay.h
+//
+// Host stand-in for avr-libc's <util/delay.h>
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "sim.h"
+
+static inline void _delay_ms(double ms) {
+	sim_delay_us(ms * 1000.0);
+}
+
+static inline void _delay_us(double us) {
+	sim_delay_us(us);
+}
+
+#endif // SIM_UTIL_DELAY_H
@@ -0,0 +1,21 @@
+// Name: util/setbaud.h
+//
+// Host stand-in for avr-libc's <util/setbaud.h>. Like the original it is included after BAUD
+// is defined, and may be included more than once.
+
+#ifndef F_CPU
+#error "F_CPU must be defined"
+#endif
+#ifndef BAUD
+#error "BAUD must be defined"
+#endif
+
+#undef UBRR_VALUE
+#undef UBRRL_VALUE
+#undef UBRRH_VALUE
+#undef USE_2X
+
+#define UBRR_VALUE (((F_CPU) + 8UL * (BAUD)) / (16UL * (BAUD)) - 1UL)
+#define UBRRL_VALUE (UBRR_VALUE & 0xff)
+#define UBRRH_VALUE (UBRR_VALUE >> 8)
+#define USE_2X 0
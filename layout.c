@@ -0,0 +1,135 @@
+// Name: layout.c
+//
+// Counts the CPU cycles the two storage layouts of ring.h take on the AVR: RING_DEFINE() with
+// an array of RGB structs, and RING_DEFINE_SOA() with an r, a g and a b plane, each holding
+// QUEUE_LENGTH - 1 items. The operations are the ones tools/layout times on the host:
+//
+//   item     enqueue() and dequeue() one item at a time, what main.c does
+//   scale    scale the red channel of every queued item in place, a channel at a time
+//   sum      add up the green channel of every queued item
+//
+// The AVR has no vector unit, so the difference is all in the addressing: an item in the array
+// of structs is at items + 3 * i, a multiply (or shift and add) per access, while each plane is
+// indexed directly, at the price of one address calculation per plane.
+//
+// Timer 1 runs at CLK_io for the count, and the cost of the call itself is taken off. The host
+// simulator does not count the cycles of the code it runs, so run this on the AVR or simavr.
+//
+// Build with "make TARGET=layout".
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "example.h"
+#include "log.h"
+#include "ring.h"
+
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 128
+#endif
+
+#define RGB_FIELDS(X, a) X(uint8_t, r, a) X(uint8_t, g, a) X(uint8_t, b, a)
+
+RING_DEFINE(RGBQueue, RGB, QUEUE_LENGTH)
+RING_DEFINE_SOA(RGBPlanes, RGB, RGB_FIELDS, QUEUE_LENGTH)
+
+RGBQueue aos;
+RGBPlanes soa;
+
+// Keeps the results alive
+volatile uint16_t sink;
+volatile uint8_t scale = 200;
+
+static void nothing(void) {
+}
+
+static void aos_item(void) {
+	for (uint8_t i = 0; i < QUEUE_LENGTH - 1; i++) {
+		RGB rgb = { i, i, i };
+		RGBQueue_enqueue(&aos, &rgb);
+	}
+	uint16_t sum = 0;
+	while (!RGBQueue_empty(&aos)) {
+		RGB rgb;
+		RGBQueue_dequeue(&aos, &rgb);
+		sum += rgb.r + rgb.g + rgb.b;
+	}
+	sink = sum;
+}
+
+static void soa_item(void) {
+	for (uint8_t i = 0; i < QUEUE_LENGTH - 1; i++) {
+		RGB rgb = { i, i, i };
+		RGBPlanes_enqueue(&soa, &rgb);
+	}
+	uint16_t sum = 0;
+	while (!RGBPlanes_empty(&soa)) {
+		RGB rgb;
+		RGBPlanes_dequeue(&soa, &rgb);
+		sum += rgb.r + rgb.g + rgb.b;
+	}
+	sink = sum;
+}
+
+// The queues are filled from index 0, so the items are a single run of slots
+static void aos_scale(void) {
+	uint8_t s = scale;
+	for (uint8_t i = aos.head; i != aos.tail; i++)
+		aos.items[i].r = aos.items[i].r * s >> 8;
+}
+
+static void soa_scale(void) {
+	uint8_t s = scale;
+	for (uint8_t i = soa.head; i != soa.tail; i++)
+		soa.r[i] = soa.r[i] * s >> 8;
+}
+
+static void aos_sum(void) {
+	uint16_t sum = 0;
+	for (uint8_t i = aos.head; i != aos.tail; i++)
+		sum += aos.items[i].g;
+	sink = sum;
+}
+
+static void soa_sum(void) {
+	uint16_t sum = 0;
+	for (uint8_t i = soa.head; i != soa.tail; i++)
+		sum += soa.g[i];
+	sink = sum;
+}
+
+// Cycles fn() takes, with the queues full or, for the item passes that fill them themselves,
+// empty
+static uint16_t cycles(void (*fn)(void), uint8_t full) {
+	aos.head = aos.tail = soa.head = soa.tail = 0;
+	for (uint8_t i = 0; full && i < QUEUE_LENGTH - 1; i++) {
+		RGB rgb = { i, i * 2, i * 3 };
+		RGBQueue_enqueue(&aos, &rgb);
+		RGBPlanes_enqueue(&soa, &rgb);
+	}
+
+	TCNT1 = 0;
+	fn();
+	return TCNT1;
+}
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+	LOG("Queue Layout Example\n\n");
+
+	// Timer 1 at CLK_io, interrupts stay off
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+
+	uint16_t call = cycles(nothing, 0);
+	LOG("##### Layout: %u items, cycles per pass: item scale sum\n", QUEUE_LENGTH - 1);
+	LOG("##### aos %u %u %u\n", cycles(aos_item, 0) - call, cycles(aos_scale, 1) - call,
+		cycles(aos_sum, 1) - call);
+	LOG("##### soa %u %u %u\n", cycles(soa_item, 0) - call, cycles(soa_scale, 1) - call,
+		cycles(soa_sum, 1) - call);
+
+	for (;;)
+		;
+	return 0;
+}
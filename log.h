@@ -0,0 +1,134 @@
+// Name: log.h
+//
+// Logging over the USART for main() and ISRs alike: LOG(fmt, ...) takes a printf() format and
+// its arguments, and sends the line as one piece.
+//
+// By default the line is formatted on the AVR with snprintf() and transmitted as text. Define
+// LOG_DEFERRED to leave the formatting to the host instead: the format strings are kept in a
+// section of their own ("logfmt") that ends up in main.elf but not in main.hex, and LOG() only
+// transmits a frame of
+//
+//   LOG_SYNC, format id (2 bytes), arguments (2 bytes each)
+//
+// where the id is the offset of the format string in the logfmt section, and multi-byte values
+// are little endian. tools/logdec reads the format strings from main.elf and turns the frames
+// back into text. A typical consumer line then takes 8 bytes instead of 50, and no snprintf().
+//
+// In deferred mode every argument is sent as a 16-bit integer, so only the integer conversions
+// (%d %i %u %x %X %o %c, with flags and width) are supported, and a %s prints as "?". The
+// format strings cost neither flash nor RAM, which also makes it cheap to log more.
+//
+// Only the host side of this has been run: host builds decode end to end through tools/logdec,
+// and so does a 32-bit ELF linked by GNU ld with logfmt at 0x900000 like the Makefile does.
+// That avr-ld places the section there, defines __start_logfmt and keeps the offsets right
+// with 16-bit pointers has not been checked with avr-gcc yet. The first line of a LOG_DEFERRED
+// build decoding as "Producer/Consumer Example" confirms it.
+//
+// LOG_APPEND(buf, len, fmt, ...) puts the same line (or frame) in the char array buf instead,
+// after the len bytes already there, and adds its length to len. It is for output that an
+// interrupt sends a byte at a time, so nothing waits for the USART. A line that does not fit
+// is cut short, a frame that does not fit is left out. len must stay below sizeof(buf).
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <util/atomic.h>
+
+#include "usart.h"
+
+// Uncomment the following line to format log lines on the host, see above
+//#define LOG_DEFERRED
+
+// LOG() disables interrupts while it transmits, so that lines from main() and from ISRs do not
+// get mixed up. Programs that only log from main(), and cannot have their ISRs held off for the
+// length of a line, define LOG_SINGLE_CONTEXT before including this file.
+#ifdef LOG_SINGLE_CONTEXT
+#define LOG_ATOMIC
+#else
+#define LOG_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+
+// First byte of a deferred frame. Text is 7-bit ASCII, so it never contains this byte.
+#define LOG_SYNC 0xfe
+
+#ifdef LOG_DEFERRED
+
+// Provided by the linker for the logfmt section
+extern const char __start_logfmt[];
+
+#define LOG(fmt, ...) do {																\
+	static const char log_fmt_[] __attribute__((section("logfmt"), used)) = fmt;		\
+	const int16_t log_args_[] = { __VA_ARGS__ };										\
+	log_frame(log_fmt_ - __start_logfmt, log_args_, sizeof(log_args_) / sizeof(int16_t));	\
+} while (0)
+
+#define LOG_APPEND(buf, len, fmt, ...) do {													\
+	static const char log_fmt_[] __attribute__((section("logfmt"), used)) = fmt;		\
+	const int16_t log_args_[] = { __VA_ARGS__ };										\
+	(len) += log_frame_to((uint8_t *)(buf) + (len), sizeof(buf) - 1 - (len),			\
+		log_fmt_ - __start_logfmt, log_args_, sizeof(log_args_) / sizeof(int16_t));		\
+} while (0)
+
+static inline uint8_t log_frame_to(uint8_t *out, uint16_t room, uint16_t id,
+								   const int16_t *args, uint8_t count) {
+	uint8_t len = 3 + 2 * count;
+	if (len > room)
+		return 0;
+
+	*out++ = LOG_SYNC;
+	*out++ = id;
+	*out++ = id >> 8;
+	while (count--) {
+		*out++ = *args;
+		*out++ = *args++ >> 8;
+	}
+	return len;
+}
+
+static inline void log_frame(uint16_t id, const int16_t *args, uint8_t count) {
+	LOG_ATOMIC {
+		USART_Transmit(LOG_SYNC);
+		USART_Transmit(id);
+		USART_Transmit(id >> 8);
+		while (count--) {
+			USART_Transmit(*args);
+			USART_Transmit(*args++ >> 8);
+		}
+	}
+}
+
+#else
+
+// Longest line LOG() formats on the AVR, longer ones are cut short
+#ifndef LOG_LINE_MAX
+#define LOG_LINE_MAX 128
+#endif
+
+// Called after each line formatted on the AVR. The host simulator uses it to charge the time
+// snprintf() takes there.
+#ifndef LOG_FORMAT_HOOK
+#define LOG_FORMAT_HOOK()
+#endif
+
+#define LOG(fmt, ...) do {												\
+	char log_buf_[LOG_LINE_MAX];										\
+	snprintf(log_buf_, sizeof(log_buf_), fmt, ##__VA_ARGS__);			\
+	LOG_FORMAT_HOOK();													\
+	LOG_ATOMIC {														\
+		USART_TransmitString(log_buf_);									\
+	}																	\
+} while (0)
+
+#define LOG_APPEND(buf, len, fmt, ...) do {								\
+	uint16_t log_room_ = sizeof(buf) - (len);							\
+	int log_n_ = snprintf((buf) + (len), log_room_, fmt, ##__VA_ARGS__);	\
+	LOG_FORMAT_HOOK();													\
+	if (log_n_ > 0)														\
+		(len) += log_n_ < log_room_ ? log_n_ : log_room_ - 1;			\
+} while (0)
+
+#endif // LOG_DEFERRED
+
+#endif // LOG_H
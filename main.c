@@ -33,181 +33,582 @@
 #include <stdint.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <stdio.h>
-#include <util/delay.h>
 #include <stdlib.h>
 
-// Note that this is only used for atomic calls to USART_TransmitString()
-#include <util/atomic.h>
+// Uncomment the following line to sample where the CPU spends its time, and send the
+// histogram every few seconds for tools/profile to map to functions (see profile.h)
+//#define PROFILE
+
+#include "example.h"
+#include "log.h"
+#include "profile.h"
+#include "ring.h"
+#include "sched.h"
+#include "wheel.h"
 
 #define NELEMS(x) (sizeof(x)/sizeof((x)[0]))
 
-// In this example our queue will hold RGB triplets
-struct _RGB {
-	uint8_t r;
-	uint8_t g;
-	uint8_t b;
-};
-typedef struct _RGB RGB;
+// The values below can be overridden from the command line (e.g. -DQUEUE_LENGTH=64), which is
+// how the host benchmarks in host/ compare different queue configurations.
 
 // It is a good idea to make your queue length be a power of 2
-volatile RGB queue[128];
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 128
+#endif
 
-// No mutex necessary, since this is a uint8_t,
-// and the ISR is the only place it is ever modified
-volatile uint8_t head = 0;
+#if QUEUE_LENGTH > 256
+#error "QUEUE_LENGTH must fit the uint8_t head and tail indices"
+#endif
 
-// No mutex necessary, since this is a uint8_t,
-// and main() is the only place it is ever modified
-volatile uint8_t tail = 0;
+// Number of items that must be on the queue before the producer enables the consumer.
+// The default waits for a full queue, a lower watermark starts consuming sooner.
+#ifndef CONSUMER_START_LEVEL
+#define CONSUMER_START_LEVEL (QUEUE_LENGTH - 1)
+#endif
 
-// Initially start with the consumer disabled, since we want
-// the queue to fill up before it starts consuming.
-// Don't worry, the producer will enable the consumer as soon
-// as it notices the queue is full
-volatile uint8_t enable_consumer = 0;
+// Initial number of timer cycles between dequeues. Set to 1 to auto-calibrate.
+#ifndef CONSUME_EVERY
+#define CONSUME_EVERY 1
+#endif
 
-// This allows us to manually increase the time between consumption
-volatile uint8_t consume_every_modifier = 0;
+// Initial value of consume_every_modifier, see below
+#ifndef CONSUME_EVERY_MODIFIER
+#define CONSUME_EVERY_MODIFIER 0
+#endif
 
-// Returns 1 if the queue is empty, 0 otherwise
-static inline uint8_t empty() {
-	return (head == tail);
-}
+// How many ms the producer of queue q waits after each item, standing in for real work
+#ifndef PRODUCER_DELAY_MS
+#define PRODUCER_DELAY_MS(q) (random() % 16)
+#endif
 
-// Returns 1 if the queue is full, 0 otherwise
-static inline uint8_t full() {
-	return (head == (tail + 1) % NELEMS(queue));
-}
+// Number of producer tasks. Each one fills its own queue, which has its own consumer in the
+// ISR. Keep in mind that every queue takes QUEUE_LENGTH * 3 bytes of the 2K of RAM.
+#ifndef PRODUCERS
+#define PRODUCERS 1
+#endif
 
-// enqueue() should never be called on a full queue
-// and should only be called by main()
-static inline void enqueue(RGB *rgb) {
-	queue[tail] = *rgb;
-	tail = (tail + 1) % NELEMS(queue);
-}
+// Slots in the timer wheel that tells the ISR which consumers are due (see wheel.h). A tick
+// costs the same however many consumers there are, as long as they consume at least every
+// CONSUMER_WHEEL_SLOTS timer cycles. Must be a power of 2.
+#ifndef CONSUMER_WHEEL_SLOTS
+#define CONSUMER_WHEEL_SLOTS 16
+#endif
 
-// dequeue() should never be called on an empty queue
-// and should only be called by the ISR
-static inline void dequeue(RGB *rgb) {
-	*rgb = queue[head];
-	head = (head + 1) % NELEMS(queue);
-}
+// Uncomment the following line to keep the queued colours across a reset that leaves the RAM
+// powered (watchdog, brown-out, reset pin). The queues, their indices and the producers' next
+// colours are then placed in .noinit, which the C runtime does not clear, and main() checks
+// them before it starts (see restore_queues()). If they pass, the consumers go on draining
+// them right away, instead of waiting for the queues to fill up again.
+//#define WARM_RESTART
+
+#ifdef WARM_RESTART
+#define NOINIT __attribute__((section(".noinit")))
+#else
+#define NOINIT
+#endif
+
+// See ring.h for how the queue works, and why no mutex is necessary
+RING_DEFINE(RGBQueue, RGB, QUEUE_LENGTH)
+
+RGBQueue queues[PRODUCERS] NOINIT;
+
+#ifdef WARM_RESTART
+// Written when the queues have been set up, not likely to be found in RAM by chance
+#define WARM_MAGIC 0x5157
 
-// Standard USART initialization, except we only enable the transmitter
-static void USART_Init(void) {
-	// Enable transmitter only
-	UCSR0B |= (1 << TXEN0);
+// What a warm restart checks the queues against. The sums of the r, g and b values of all
+// items enqueued and dequeued, mod 2^16, which must differ by the sum of the items on the
+// queue. Like head and tail, each has only one writer.
+struct _Persist {
+	uint16_t magic;
+	uint16_t added[PRODUCERS];		// only ever modified by the producer
+	uint16_t removed[PRODUCERS];	// only ever modified by the consumer
+};
+typedef struct _Persist Persist;
+
+Persist persist NOINIT;
+
+static inline uint16_t rgb_sum(const RGB *rgb) {
+	return rgb->r + rgb->g + rgb->b;
 }
+#endif
+
+// Initially start with the consumers disabled, since we want
+// the queues to fill up before they start consuming.
+// Don't worry, the producer will enable a consumer as soon
+// as it notices its queue is full
+volatile uint8_t enable_consumer[PRODUCERS];
+
+// This allows us to manually increase the time between consumption. A change takes effect
+// after each consumer's next dequeue.
+volatile uint8_t consume_every_modifier = CONSUME_EVERY_MODIFIER;
+
+// Uncomment the following line to have the consumer append a telemetry frame to its output
+// every TELEMETRY_EVERY consumed items. The host monitor in tools/ reads these frames to show
+// the queue occupancy and underrun count, which cannot be inferred from the consumed lines.
+//#define TELEMETRY_EVERY 64
+
+// Uncomment the following line to measure how steady the consumption is. Each dequeue is
+// timestamped with the scheduler clock (13.9 us resolution), and the time since the previous
+// one is compared with the nominal consume_every Timer 0 periods, which are exactly 256 ticks
+// each. Every JITTER_EVERY intervals the smallest, largest and mean deviation and its standard
+// deviation are reported in us. The deviation comes from the ISR being held off (by main()
+// logging or other ISRs), and from the varying time the ISR takes before it dequeues. An
+// underrun starts the measurement over, since the consumer pauses. The report is printed by
+// the ISR as well, so at 115200 baud it may hold off the next dequeue by a Timer 0 period,
+// which shows up as the maximum.
+//#define JITTER_EVERY 256
+
+#ifdef JITTER_EVERY
+// Deviations are clamped to this many ticks (32 ms), so the sums fit and the us fit an int16_t
+#define JITTER_CLAMP 2300
+
+#if JITTER_EVERY > 4294967295 / (JITTER_CLAMP * JITTER_CLAMP)
+#error "JITTER_EVERY must be at most 811, or the sum of the squared deviations may overflow"
+#endif
+
+// The scale is signed, so that negative deviations are not promoted to unsigned
+#define JITTER_US(ticks) ((int32_t)(ticks) * (int32_t)(256000000UL / (F_CPU / 1000)) / 1000)
+typedef char jitter_us_check[JITTER_US(-JITTER_CLAMP) == -JITTER_US(JITTER_CLAMP) ? 1 : -1];
+#endif
+
+// Uncomment the following line to let the USART pull the items instead of Timer 0 pushing
+// them, for when the output link is the bottleneck rather than the producers. The consumer's
+// output is put in a buffer, and the data register empty interrupt sends it a byte at a time
+// and dequeues the next item as soon as the last byte is on its way, so the queues drain at
+// exactly the speed of the link and no Timer 0 period is wasted waiting in between.
+//
+// A consumer falls back to being paced by Timer 0 when a steady rate is required: after its
+// first underrun, which shows that the producer cannot keep up with the link, and while
+// consume_every_modifier asks for a slower rate. The buffer is used in both cases, so that the
+// ISRs never wait for the USART. main() must not log while the consumers are running, so the
+// PROFILE report cannot be used, and JITTER_EVERY cannot either, as the consumers pulled by the
+// USART have no nominal interval to compare with.
+//#define OUTPUT_PACED
+
+#ifdef OUTPUT_PACED
+#ifdef PROFILE
+#error "PROFILE logs from main(), which OUTPUT_PACED does not allow"
+#endif
+
+#ifdef JITTER_EVERY
+#error "JITTER_EVERY measures against the Timer 0 pacing, which OUTPUT_PACED replaces"
+#endif
+
+// Size of the output buffer, which takes what one dequeue logs. Lines that do not fit are cut
+// short, so make it larger along with TELEMETRY_EVERY.
+#ifndef OUTPUT_BUFFER
+#define OUTPUT_BUFFER 128
+#endif
+
+#if OUTPUT_BUFFER > 255
+#error "OUTPUT_BUFFER must fit the uint8_t buffer positions"
+#endif
 
-// Standard way to set the baud rate using avr-libc's helper 'bacros'
-static void USART_115200(void) {
-#undef BAUD  // avoid potential compiler warning
-#define BAUD 115200
-#include <util/setbaud.h>
-	UBRR0H = UBRRH_VALUE;
-	UBRR0L = UBRRL_VALUE;
-#if USE_2X
-	UCSR0A |= (1 << U2X0);
+static char output[OUTPUT_BUFFER];
+static uint8_t output_len, output_sent;		// only used by the ISRs
+
+#define CONSUMER_LOG(fmt, ...) LOG_APPEND(output, output_len, fmt, ##__VA_ARGS__)
 #else
-	UCSR0A &= ~(1 << U2X0);
+#define CONSUMER_LOG LOG
+#endif
+
+// What the ISR keeps for each queue it consumes from
+struct _Consumer {
+	// Set while the queue is filling up, the first dequeue after that is a full period later
+	uint8_t waiting;
+
+#ifdef OUTPUT_PACED
+	uint8_t paced;			// cleared once the consumer has fallen back to Timer 0
+	uint8_t pulled;			// set while the USART, rather than the timer wheel, runs it
+#endif
+
+	// Timer cycles that need to pass before we dequeue. Set to 1 to auto-calibrate.
+	uint8_t consume_every;
+
+#ifdef TELEMETRY_EVERY
+	// Running totals reported in the telemetry frames, these are allowed to wrap
+	uint16_t consumed;
+	uint16_t underruns;
+#endif
+
+#ifdef JITTER_EVERY
+	uint16_t last;			// tick of the previous dequeue
+	uint8_t has_last;		// whether last is valid
+	uint16_t intervals;		// measured since the last report
+	int16_t dev_min, dev_max;
+	int32_t dev_sum;
+	uint32_t dev_squares;
 #endif
+};
+typedef struct _Consumer Consumer;
+
+#ifdef JITTER_EVERY
+static uint16_t isqrt(uint32_t x) {
+	uint32_t root = 0;
+	for (uint32_t bit = 1UL << 30; bit; bit >>= 2) {
+		if (x >= root + bit) {
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+	}
+	return root;
 }
 
-// Standard way to transmit a character over the USART
-static void USART_Transmit(unsigned char data) {
-	// Wait for empty transmit buffer
-	while (!(UCSR0A & (1 << UDRE0)));
-	
-	// Put data into buffer, sends the data
-	UDR0 = data;
+// Adds the interval that ended with the dequeue at tick now, and reports once JITTER_EVERY
+// intervals have been measured
+static inline void measure_jitter(uint8_t q, Consumer *consumer, uint16_t now) {
+	uint8_t every = consumer->consume_every + consume_every_modifier;
+	uint8_t had_last = consumer->has_last;
+	int16_t dev = (int16_t)((uint16_t)(now - consumer->last) - ((uint16_t)every << 8));
+
+	consumer->last = now;
+	consumer->has_last = 1;
+	if (!had_last)
+		return;
+
+	if (dev > JITTER_CLAMP)
+		dev = JITTER_CLAMP;
+	else if (dev < -JITTER_CLAMP)
+		dev = -JITTER_CLAMP;
+	if (!consumer->intervals || dev < consumer->dev_min)
+		consumer->dev_min = dev;
+	if (!consumer->intervals || dev > consumer->dev_max)
+		consumer->dev_max = dev;
+	consumer->dev_sum += dev;
+	consumer->dev_squares += (int32_t)dev * dev;
+
+	if (++consumer->intervals < JITTER_EVERY)
+		return;
+
+	uint16_t n = consumer->intervals;
+	int32_t mean = consumer->dev_sum / n;
+	// The mean is at most JITTER_CLAMP, so unlike the sum it can be squared in 32 bits. Its
+	// truncation only makes the square smaller, so the variance never goes negative.
+	uint32_t variance = consumer->dev_squares / n - (uint32_t)(mean * mean);
+#if PRODUCERS > 1
+	CONSUMER_LOG("##### Jitter: intervals %u min %d max %d mean %d stddev %d us queue: %d\n", n,
+		(int16_t)JITTER_US(consumer->dev_min), (int16_t)JITTER_US(consumer->dev_max),
+		(int16_t)JITTER_US(mean), (int16_t)JITTER_US(isqrt(variance)), q);
+#else
+	(void)q;
+	CONSUMER_LOG("##### Jitter: intervals %u min %d max %d mean %d stddev %d us\n", n,
+		(int16_t)JITTER_US(consumer->dev_min), (int16_t)JITTER_US(consumer->dev_max),
+		(int16_t)JITTER_US(mean), (int16_t)JITTER_US(isqrt(variance)));
+#endif
+	consumer->intervals = 0;
+	consumer->dev_sum = 0;
+	consumer->dev_squares = 0;
 }
+#endif
+
+// Dequeues an item from queue q and outputs it, or deals with the queue having run dry.
+// Returns the number of timer cycles until the next dequeue.
+static inline uint16_t dequeue(uint8_t q, Consumer *consumer) {
+	RGBQueue *queue = &queues[q];
+	uint16_t every = consumer->consume_every + consume_every_modifier;
+
+	if (!RGBQueue_empty(queue)) {	// Is there something on the queue?
+		RGB rgb;
+		RGBQueue_dequeue(queue, &rgb);	// Hooray, let's see what it is!
+#ifdef WARM_RESTART
+		persist.removed[q] += rgb_sum(&rgb);
+#endif
+#ifdef JITTER_EVERY
+		uint16_t dequeued_at = sched_now();
+#endif
+
+		// Do something interesting with it...
+		// Here we just log it
+#if PRODUCERS > 1
+		CONSUMER_LOG("<<<<< Consumed: (%d, %d, %d) consuming every: %d queue: %d\n",
+			rgb.r, rgb.g, rgb.b, consumer->consume_every + consume_every_modifier, q);
+#else
+		CONSUMER_LOG("<<<<< Consumed: (%d, %d, %d) consuming every: %d\n",
+			rgb.r, rgb.g, rgb.b, consumer->consume_every + consume_every_modifier);
+#endif
+
+#ifdef TELEMETRY_EVERY
+		// Every so often, follow up with a frame describing the state of the queue itself
+		if (++consumer->consumed % TELEMETRY_EVERY == 0) {
+#if PRODUCERS > 1
+			CONSUMER_LOG("##### Telemetry: consumed %u occupancy %u underruns %u every %u "
+				"queue: %d\n", consumer->consumed, RGBQueue_count(queue), consumer->underruns,
+				consumer->consume_every + consume_every_modifier, q);
+#else
+			CONSUMER_LOG("##### Telemetry: consumed %u occupancy %u underruns %u every %u\n",
+				consumer->consumed, RGBQueue_count(queue), consumer->underruns,
+				consumer->consume_every + consume_every_modifier);
+#endif
+		}
+#endif
+
+#ifdef JITTER_EVERY
+		// The report comes after the consumed line, which keeps its place in the output
+		measure_jitter(q, consumer, dequeued_at);
+#endif
+	} else {
+		// If we get here it means that we are consuming too fast
+		consumer->consume_every++;	// wait an additional cycle next time
+		enable_consumer[q] = 0;		// wait for the queue to fill up before we try again
+#ifdef TELEMETRY_EVERY
+		consumer->underruns++;
+#endif
+#ifdef JITTER_EVERY
+		consumer->has_last = 0;
+#endif
+		
+		// Complain that the queue was empty, and let us know what consume_every has
+		// increased to. Once your code is stable, you'll want to remove this line
+		// and probably hard code the maximum value you saw as the initial value for
+		// consume_every above (instead of always starting at 1)
+#if PRODUCERS > 1
+		CONSUMER_LOG("Queue is empty! Increased consume_every to: %d queue: %d\n",
+			consumer->consume_every, q);
+#else
+		CONSUMER_LOG("Queue is empty! Increased consume_every to: %d\n", consumer->consume_every);
+#endif
 
-// Standard way to transmist a string over the USART, though since strings are printed from
-// both the ISR and main() This is wrapped in an ATOMIC_BLOCK, which will disable interrupts
-// if enabled, print the string, and then restore interrupts if they were enabled. This is
-// done solely to prevent the strings printed from the ISR and main() from getting mixed
-// together in the middle of a line. If we did not print from both main() and the ISR, we
-// would not have to disable interrupts!
-static void USART_TransmitString(char *data) {
-		while (*data)
-			USART_Transmit(*data++);
+		// Look at the queue every timer cycle again until it has filled up
+		every = 1;
+#ifdef OUTPUT_PACED
+		consumer->paced = 0;	// the producer cannot keep up with the link, use the timer
+#endif
+	}
+
+#ifdef OUTPUT_PACED
+	UCSR0B |= (1 << UDRIE0);	// the USART sends the output from here
+#endif
+	return every;
 }
 
-// This sets up Timer 0 to be called every CLK_io / 256 / 256 cycles.
-// The second / 256 is there because we are only called on 8-bit overflow.
-static void Timer0_Init(void) {
-	// Normal port operation, OC0A disconnected; Normal
-	TCCR0A = 0;
-	
-	// CLK_io / 256 (3.556 ms period at 18.432MHz)
-	TCCR0B |= (1 << CS02);
-	
-	// Enable overflow interrupt
-	TIMSK0 |= (1 << TOIE0);
-	
-	// Enable global interrupts
-	sei();
+// Consumes from queue q, if it is time to. Returns the number of timer cycles until it should
+// be called again, or 0 if the USART runs the consumer from now on.
+static inline uint16_t consume(uint8_t q, Consumer *consumer) {
+	uint16_t every = consumer->consume_every + consume_every_modifier;
+
+	// Until the producer enables us, look at the queue every timer cycle
+	if (!enable_consumer[q]) {
+		consumer->waiting = 1;
+		return 1;
+	}
+
+#ifdef OUTPUT_PACED
+	// Hand the consumer over to the USART, unless a steady rate is required
+	if (consumer->paced && !consume_every_modifier) {
+		consumer->pulled = 1;
+		UCSR0B |= (1 << UDRIE0);
+		return 0;
+	}
+#endif
+
+	// Counting the cycle the queue was found ready in, wait every cycles for the first dequeue
+	if (consumer->waiting) {
+		consumer->waiting = 0;
+		if (every > 1)
+			return every - 1;
+	}
+
+#ifdef OUTPUT_PACED
+	// The previous output has to be on its way before there is room for more
+	if (output_len)
+		return 1;
+#endif
+
+	return dequeue(q, consumer);
 }
 
+// Normally the delays will be measured in clock cycles (due to actual code that main() is
+// running, not a random delay in ms), so once the optimal consume_every value is found
+// experimentally (be sure to exercise the long code paths) we can hard code that value
+// as CONSUME_EVERY so as to never drain the buffer completely. This lets us change the
+// clock speed without having to recompile or recalculate anything.
+static Consumer consumers[PRODUCERS] = {
+#ifdef OUTPUT_PACED
+	[0 ... PRODUCERS - 1] = { .waiting = 1, .consume_every = CONSUME_EVERY, .paced = 1 }
+#else
+	[0 ... PRODUCERS - 1] = { .waiting = 1, .consume_every = CONSUME_EVERY }
+#endif
+};
+
+// Which consumer is due in which timer cycle, only used by the ISRs once the timer is started
+WHEEL_DEFINE(ConsumerWheel, CONSUMER_WHEEL_SLOTS, PRODUCERS)
+static ConsumerWheel consumer_wheel;
+
 // Here is the routine that is called whenever timer 0 overflows
 // Note that we can also use this interrupt for debouncing buttons, though depending on
 // the prescale you choose, you might want to wait for multiple timer cycles to debounce,
 // using the same trick, but a different cycle variable to count debouncing timer cycles
 ISR(TIMER0_OVF_vect) {
-	// Cycle counter for knowing when we should attempt a dequeue
-	static uint8_t cycle = 0;
-	
-	// Normally the delays will be measured in clock cycles (due to actual code that main() is
-	// running, not a random delay in ms), so once the optimal consume_every value is found
-	// experimentally (be sure to exercise the long code paths) we can hard code that value
-	// below so as to never drain the buffer completely. This lets us change the clock speed
-	// without having to recompile or recalculate anything.
-	
-	// Timer cycles that need to pass before we dequeue. Set to 1 to auto-calibrate.
-	static uint8_t consume_every = 1;
-	
-	// If enough timer cycles have passed to attempt a dequeue.
-	// The >= is used in case consume_every_modifier is ever increased and then decreased
-	if (enable_consumer && ++cycle >= (consume_every + consume_every_modifier)) {
-		cycle = 0;				// reset the cycle counter
+	// Run the consumers that are due this cycle, each one says when it is due next
+	ConsumerWheel_advance(&consumer_wheel);
+	for (uint8_t q; (q = ConsumerWheel_pop(&consumer_wheel)) != WHEEL_NONE; ) {
+		uint16_t delay = consume(q, &consumers[q]);
+		if (delay)
+			ConsumerWheel_schedule(&consumer_wheel, q, delay);
+	}
+}
 
-		char buf[128] = { 0 };	// just a buffer for our strings
-		
-		if (!empty()) {			// Is there something on the queue?
-			RGB rgb;
-			dequeue(&rgb);		// Hooray, let's see what it is!
-
-			// Do something interesting with it...
-			// Here we just stuff it into a string which will later be printed
-			snprintf(buf, NELEMS(buf),
-					 "<<<<< Consumed: (%d, %d, %d) consuming every: %d\n",
-					 rgb.r, rgb.g, rgb.b, consume_every + consume_every_modifier);
+#ifdef OUTPUT_PACED
+// Called whenever the USART can take another byte while UDRIE0 is set. Once the output has gone
+// out, the consumers the USART runs take turns to dequeue, and one whose queue has run dry, or
+// that has to keep a steady rate, goes back to the timer wheel.
+ISR(USART_UDRE_vect) {
+	static uint8_t next_q;
+
+	if (output_sent == output_len) {
+		output_sent = output_len = 0;
+
+		for (uint8_t i = 0; i < PRODUCERS && !output_len; i++) {
+			uint8_t q = next_q;
+			Consumer *consumer = &consumers[q];
+			next_q = q + 1 < PRODUCERS ? q + 1 : 0;
+
+			if (!consumer->pulled)
+				continue;
+			if (!consume_every_modifier)
+				dequeue(q, consumer);
+			if (!enable_consumer[q] || consume_every_modifier) {
+				consumer->pulled = 0;
+				ConsumerWheel_schedule(&consumer_wheel, q, 1);
+			}
+		}
+
+		// Nothing to send until a consumer has output again
+		if (!output_len) {
+			UCSR0B &= ~(1 << UDRIE0);
+			return;
+		}
+	}
+
+	UDR0 = output[output_sent++];
+}
+#endif
+
+// The next color each producer task will put on its queue
+static RGB next_rgb[PRODUCERS] NOINIT;
+
+// Let's keep it simple and count through all 2^24 colors, the same
+// order 3 nested loops over r, g and b would give us.
+static inline void next_color(RGB *rgb) {
+	if (++rgb->b == 0 && ++rgb->g == 0)
+		++rgb->r;
+}
+
+#ifdef WARM_RESTART
+// Whether queue q survived the reset: the indices are in range, the items add up to what was
+// enqueued and dequeued, and the producer's next colour follows the last one queued. A reset in
+// the middle of an enqueue or dequeue fails the check, which only costs what was queued.
+static uint8_t queue_intact(uint8_t q) {
+	RGBQueue *queue = &queues[q];
+	if (queue->head >= QUEUE_LENGTH || queue->tail >= QUEUE_LENGTH)
+		return 0;
+
+	uint16_t sum = 0;
+	RGB last = next_rgb[q];
+	for (uint8_t i = queue->head; i != queue->tail; i = (i + 1) % QUEUE_LENGTH) {
+		sum += rgb_sum(&queue->items[i]);
+		last = queue->items[i];
+	}
+	if (queue->head != queue->tail)
+		next_color(&last);
+
+	return sum == (uint16_t)(persist.added[q] - persist.removed[q]) &&
+		   last.r == next_rgb[q].r && last.g == next_rgb[q].g && last.b == next_rgb[q].b;
+}
+
+// Keeps the queues that survived a warm reset, and lets their consumers start right away.
+// Everything else starts empty, as after power on, when the RAM holds random values.
+static void restore_queues(void) {
+	uint8_t cause = MCUSR;
+	uint8_t kept = 0;
+	MCUSR = 0;
+
+	for (uint8_t q = 0; q < PRODUCERS; q++) {
+		if (!(cause & (1 << PORF)) && persist.magic == WARM_MAGIC && queue_intact(q)) {
+			enable_consumer[q] = !RGBQueue_empty(&queues[q]);
+			kept += RGBQueue_count(&queues[q]);
 		} else {
-			// If we get here it means that we are consuming too fast
-			consume_every++;		// wait an additional cycle next time
-			enable_consumer = 0;	// wait for the queue to fill up before we try again
-			
-			// Complain that the queue was empty, and let us know what consume_every has
-			// increased to. Once your code is stable, you'll want to remove this line
-			// and probably hard code the maximum value you saw as the initial value for
-			// consume_every above (instead of always starting at 1)
-			snprintf(buf, NELEMS(buf),
-					 "Queue is empty! Increased consume_every to: %d\n", 
-					 consume_every);
+			queues[q].head = queues[q].tail = 0;
+			persist.added[q] = persist.removed[q] = 0;
+			next_rgb[q] = (RGB){ 0, 0, 0 };
 		}
-		
-		// Output the string we prepared
-		USART_TransmitString(buf);
 	}
+	persist.magic = WARM_MAGIC;
+
+	if (!(cause & (1 << PORF)))
+		LOG("Warm restart (MCUSR 0x%02x), %u items kept\n", cause, kept);
+}
+#endif
+
+// herein lies the producer. Rather than looping forever, it is a task that produces one color
+// for queue q each time the scheduler runs it, so the time it would otherwise spend waiting
+// can be used by the producers of the other queues.
+static uint16_t produce(uint8_t q) {
+	RGBQueue *queue = &queues[q];
+
+	if (RGBQueue_count(queue) >= CONSUMER_START_LEVEL)
+		enable_consumer[q] = 1;		// enable the consumer once enough is queued
+
+	// Stop producing if the queue is full. Only a consumer makes room, which outside OUTPUT_PACED
+	// runs on a Timer 0 overflow, so have another look right after the next one. Timer 0 counts
+	// the same ticks as Timer 1, they share the prescaler.
+	if (RGBQueue_full(queue)) {
+		enable_consumer[q] = 1;		// enable the consumer when the queue is full
+#ifdef OUTPUT_PACED
+		return 1;
+#else
+		return 256 - TCNT0;
+#endif
+	}
+
+	// Today we're producing RGB triplets!
+	RGB *rgb = &next_rgb[q];
+#ifdef WARM_RESTART
+	persist.added[q] += rgb_sum(rgb);
+#endif
+	RGBQueue_enqueue(queue, rgb);	// copy our color onto the queue!
+
+	// If you want to see when we are producing an RGB triplet, uncomment
+	// the following line. LOG() sends the whole line with interrupts
+	// disabled, otherwise the ISR could interrupt us in the middle of
+	// printing a string, which would make the output hard to read.
+
+	//LOG(">>>>> Produced: (%d, %d, %d)\n", rgb->r, rgb->g, rgb->b);
+
+	next_color(rgb);
+
+	// Choose a random delay between 0 and 15 ms. This will simulate different
+	// code paths, or operations that take a different amount of time to execute.
+	// Even though we are producing these colors at a non-uniform rate, the
+	// consumer will consume them at a steady rate that can be faster than the
+	// maximum delay between individual colors, since they are buffered in the
+	// queue. Note that if the consumer is configured to auto-calibrate its rate,
+	// it might pause and increase its buffer a few times before the consumption
+	// rate becomes steady.
+	return (uint16_t)PRODUCER_DELAY_MS(q) * SCHED_TICKS_PER_MS;
 }
 
 int main(void) {
 	// Initialize the USART, set the baud rate
 	USART_Init();
 	USART_115200();
-	USART_TransmitString("Producer/Consumer Example\n\n");
+	LOG("Producer/Consumer Example\n\n");
+
+#ifdef WARM_RESTART
+	// Before the consumers can run
+	restore_queues();
+#endif
 	
+	// Start the clock the producer tasks are scheduled by
+	sched_init();
+
+	// Every consumer first looks at its queue in the first timer cycle
+	for (uint8_t q = 0; q < PRODUCERS; q++)
+		ConsumerWheel_schedule(&consumer_wheel, q, 1);
+
 	// Configure and start the timer which is used to consume
 	Timer0_Init();
 	
@@ -217,55 +618,18 @@ int main(void) {
 	
 	//consume_every_modifier = 10;
 	
-	// herein lies the producer
-	for (;;) {
-		// Today we're producing RGB triplets!
-		RGB rgb = { 0 };
-		
-		// Let's keep it simple and just make 3 nested loops
-		// that will eventually loop over all 2^24 colors.
-		do {
-			do {
-				do {
-					// Inside here we have our RGB triplet
-					while (full())				// stop producing if the queue is full
-						enable_consumer = 1;	// enable the consumer when the queue is full
-
-					enqueue(&rgb);				// copy our color onto the queue!
-					
-					// If you want to see when we are producing an RGB triplet, uncomment
-					// the following block of code. If we did not wrap the call to
-					// USART_TransmitString() in an ATOMIC_BLOCK, the ISR could interrupt
-					// us in the middle of printing a string, which would make the output
-					// hard to read.
-
-					/*
-					char buf[128] = { 0 };
-					snprintf(buf, NELEMS(buf),
-							 ">>>>> Produced: (%d, %d, %d)\n",
-							 rgb.r, rgb.g, rgb.b);
-					
-					ATOMIC_BLOCK(ATOMIC_FORCEON) {
-						USART_TransmitString(buf);
-					}
-					*/
-					
-					// Choose a random delay between 0 and 15 ms. This will simulate different
-					// code paths, or operations that take a different amount of time to execute.
-					// Even though we are producing these colors at a non-uniform rate, the
-					// consumer will consume them at a steady rate that can be faster than the
-					// maximum delay between individual colors, since they are buffered in the
-					// queue. Note that if the consumer is configured to auto-calibrate its rate,
-					// it might pause and increase its buffer a few times before the consumption
-					// rate becomes steady.
-					uint8_t delay_in_ms = random() % 16;
-					while (delay_in_ms--)
-						_delay_ms(1); // this avoids pulling in floating point code
-					
-				} while (++rgb.b != 0);
-			} while (++rgb.g != 0);
-		} while (++rgb.r != 0);		
+	// One producer task per queue, and the profiler's, if any
+	static Task tasks[PRODUCERS + PROFILE_TASKS];
+	for (uint8_t q = 0; q < PRODUCERS; q++) {
+		tasks[q].run = produce;
+		tasks[q].arg = q;
 	}
+#if PROFILE_TASKS
+	profile_init();
+	tasks[PRODUCERS].run = profile_task;
+#endif
+
+	sched_run(tasks, PRODUCERS + PROFILE_TASKS);
 	
 	return 0;
 }
@@ -0,0 +1,62 @@
+// Name: pool.h
+//
+// Lock-free pool of fixed size blocks, for messages too large to copy through a queue. The
+// producer takes a block from the pool, fills it in, and enqueues only its 1-byte handle; the
+// consumer looks the block up by its handle and gives it back when it is done with it:
+//
+//   POOL_DEFINE(FramePool, Frame, 24)
+//
+// defines the type FramePool and the functions FramePool_init(), FramePool_alloc(),
+// FramePool_block() and FramePool_free(), which all take a pointer to the pool.
+//
+// The free list is itself a ring (see ring.h) of handles, running the other way: blocks are
+// allocated by one side only, e.g. main(), and freed by the other side only, e.g. the ISR,
+// which makes them the free list's consumer and producer, so it needs no mutex either. It has
+// room for every handle, so freeing never finds it full, and since it needs one slot more than
+// there are blocks, a pool can have at most 255 of them.
+//
+// The queue that carries the handles provides the ordering for the block's contents: the block
+// is written before its handle is enqueued, and read after it is dequeued. The free list does
+// the same on the way back, so the producer never writes a block the consumer is still reading.
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+#include "ring.h"
+
+#define POOL_DEFINE(name, type, count)												\
+	RING_DEFINE(name##FreeList, uint8_t, (count) + 1)								\
+																					\
+	typedef struct {																\
+		type blocks[count];															\
+		name##FreeList free;														\
+	} name;																			\
+																					\
+	/* Puts every block on the free list. Must be called by the allocating side	\
+	   before any block is in use. */												\
+	static inline void name##_init(name *p) {										\
+		for (uint8_t h = 0; h < (count); h++)										\
+			name##FreeList_enqueue(&p->free, &h);									\
+	}																				\
+																					\
+	/* Takes a block, returns 1 and its handle, or 0 if all of them are in use	\
+	   (allocating side) */															\
+	static inline uint8_t name##_alloc(name *p, uint8_t *handle) {					\
+		if (name##FreeList_empty(&p->free))											\
+			return 0;																\
+		name##FreeList_dequeue(&p->free, handle);									\
+		return 1;																	\
+	}																				\
+																					\
+	static inline type *name##_block(name *p, uint8_t handle) {						\
+		return &p->blocks[handle];													\
+	}																				\
+																					\
+	/* Gives a block back (freeing side) */											\
+	static inline void name##_free(name *p, uint8_t handle) {						\
+		name##FreeList_enqueue(&p->free, &handle);									\
+	}
+
+#endif // POOL_H
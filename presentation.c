@@ -0,0 +1,155 @@
+// Name: presentation.c
+//
+// The producer/consumer example from main.c, but with the output timing decided by the
+// producer. Every item is stamped with the Timer 1 tick at which it is due, and the consumer
+// outputs it exactly then, no matter how unevenly it was produced. This is how a jitter buffer
+// works: the queue absorbs the producer's jitter, and PRESENTATION_DELAY_MS, the time between
+// producing the first item and outputting it, is how much jitter it can absorb.
+//
+// The consumer is the Timer 1 compare match A interrupt. Timer 1 also runs the scheduler (see
+// sched.h), so the producer and the consumer share one clock. The ISR points OCR1A at the due
+// tick of the item at the head of the queue, and while the queue is empty it has a look every
+// PRESENT_POLL_TICKS instead.
+//
+// Due ticks are 16 bits and compared with wrap-around arithmetic, so the producer may get at
+// most PRESENT_MAX_LEAD_MS ahead, which must stay below 455 ms at 18.432MHz. If it falls behind
+// instead, the item is output late and the producer starts a new timeline, PRESENTATION_DELAY_MS
+// from now, which is what rebuffering is in a media player.
+//
+// Build with "make TARGET=presentation".
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdlib.h>
+
+#include "example.h"
+#include "log.h"
+#include "ring.h"
+#include "sched.h"
+
+// An RGB triplet, and when to output it
+struct _Item {
+	RGB rgb;
+	uint16_t due;		// Timer 1 tick
+};
+typedef struct _Item Item;
+
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 64
+#endif
+
+// Time between the items the producer stamps. The producer takes 7.5 ms per item on average,
+// plus the time the ISR takes from it to print each line, so this has to be a bit more than that.
+#ifndef PRESENT_EVERY_MS
+#define PRESENT_EVERY_MS 12
+#endif
+
+// Time between producing an item and outputting it, when starting and after rebuffering
+#ifndef PRESENTATION_DELAY_MS
+#define PRESENTATION_DELAY_MS 250
+#endif
+
+// How far ahead of its due time the producer may produce an item
+#ifndef PRESENT_MAX_LEAD_MS
+#define PRESENT_MAX_LEAD_MS 400
+#endif
+
+// How often the consumer has a look while the queue is empty
+#define PRESENT_POLL_TICKS SCHED_TICKS_PER_MS
+
+#if PRESENT_MAX_LEAD_MS * SCHED_TICKS_PER_MS > 32767 || PRESENTATION_DELAY_MS > PRESENT_MAX_LEAD_MS
+#error "PRESENTATION_DELAY_MS <= PRESENT_MAX_LEAD_MS must fit in 32767 Timer 1 ticks"
+#endif
+
+// How many ms the producer waits after each item, standing in for real work
+#ifndef PRODUCER_DELAY_MS
+#define PRODUCER_DELAY_MS(q) (random() % 16)
+#endif
+
+RING_DEFINE(ItemQueue, Item, QUEUE_LENGTH)
+
+ItemQueue queue;
+
+// Enables the compare match interrupt, the first look at the queue is a poll
+static void Timer1_Init(void) {
+	OCR1A = sched_now() + PRESENT_POLL_TICKS;
+	TIMSK1 |= (1 << OCIE1A);
+	sei();
+}
+
+// The consumer outputs every item that is due, and arms the compare match for the next one
+ISR(TIMER1_COMPA_vect) {
+	for (;;) {
+		uint16_t now = TCNT1;
+
+		if (ItemQueue_empty(&queue)) {
+			OCR1A = now + PRESENT_POLL_TICKS;
+			return;
+		}
+
+		Item *item = ItemQueue_peek(&queue);
+		int16_t early = item->due - now;
+		if (early > 0) {
+			OCR1A = item->due;
+
+			// If the due tick went by while we were busy, the match will not happen until
+			// the counter wraps around, so check again
+			if ((int16_t)(item->due - TCNT1) > 0)
+				return;
+			continue;
+		}
+
+		Item it;
+		ItemQueue_dequeue(&queue, &it);
+		LOG("<<<<< Consumed: (%d, %d, %d) late: %d\n", it.rgb.r, it.rgb.g, it.rgb.b, -early);
+	}
+}
+
+// The producer task, it stamps and enqueues one item each time it runs
+static uint16_t produce(uint8_t unused) {
+	static RGB rgb;
+	static uint16_t next_due;
+	static uint8_t started = 0;
+	(void)unused;
+
+	uint16_t now = sched_now();
+	if (!started) {
+		next_due = now + PRESENTATION_DELAY_MS * SCHED_TICKS_PER_MS;
+		started = 1;
+	}
+
+	int16_t lead = next_due - now;
+	if (lead > PRESENT_MAX_LEAD_MS * SCHED_TICKS_PER_MS)
+		return lead - PRESENT_MAX_LEAD_MS * SCHED_TICKS_PER_MS;		// far enough ahead
+	if (lead < 0) {
+		LOG("Rebuffering, %d ticks behind\n", -lead);
+		next_due = now + PRESENTATION_DELAY_MS * SCHED_TICKS_PER_MS;
+	}
+	if (ItemQueue_full(&queue))
+		return 1;
+
+	Item item = { rgb, next_due };
+	ItemQueue_enqueue(&queue, &item);
+	next_due += PRESENT_EVERY_MS * SCHED_TICKS_PER_MS;
+
+	// Count through all 2^24 colors like main.c does
+	if (++rgb.b == 0 && ++rgb.g == 0)
+		++rgb.r;
+
+	return (uint16_t)PRODUCER_DELAY_MS(0) * SCHED_TICKS_PER_MS;
+}
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+	LOG("Presentation Scheduling Example\n\n");
+
+	sched_init();
+	Timer1_Init();
+
+	static Task tasks[] = { { produce, 0, 0 } };
+	sched_run(tasks, 1);
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+// Name: profile.h
+//
+// Statistical profiler: define PROFILE before including this file, and Timer 2 samples where
+// the CPU is about 207 times a second, by taking the return address of its compare match
+// interrupt off the stack. The samples go into a histogram of PROFILE_BUCKETS counters, which
+// profile_init() makes just wide enough (a power of 2 instruction words each) to cover the
+// whole program up to _etext, library code like vfprintf included. A scheduler task (see
+// sched.h) sends it over the USART every PROFILE_DUMP_S seconds, a LOG() line per bucket that
+// was hit:
+//
+//   ##### Profile: 1234 samples, 64 bytes per bucket, 0 outside
+//   ##### Profile: bucket 12 samples 345
+//   ...
+//   ##### Profile: end
+//
+// The counters start over after each dump. tools/profile adds the dumps up and maps the
+// buckets to the functions in main.elf. Timer 2 must not be used for anything else.
+//
+// The sample interrupt only gets in while interrupts are enabled, so the time spent in other
+// ISRs and in ATOMIC_BLOCKs is counted at the first instruction after them. Its rate is not a
+// multiple of Timer 0 or of the scheduler's ticks, so it does not keep hitting the same spot
+// of a periodic task. Without PROFILE, or in the host simulator, which has no program counter
+// to sample, everything here does nothing.
+//
+// To use it, call profile_init() once and run profile_task() as one of the PROFILE_TASKS
+// tasks (0 without a profiler), after including log.h and sched.h.
+//
+// The AVR side, the naked sampling vector with its stack offsets and the bucket width from
+// _etext, has not been built with avr-gcc or run under simavr yet. Before trusting a profile,
+// check that the bucket of a busy loop matches its address in avr-objdump -d main.elf.
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#if defined(PROFILE) && defined(__AVR__)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+// 128 buckets are 64 bytes wide for up to 8K of code, and 256 bytes for the whole 32K flash
+#ifndef PROFILE_BUCKETS
+#define PROFILE_BUCKETS 128
+#endif
+
+#ifndef PROFILE_DUMP_S
+#define PROFILE_DUMP_S 10
+#endif
+
+#define PROFILE_TASKS 1
+
+// CTC at CLK_io / 1024 / 87, 206.9 Hz at 18.432MHz
+#define PROFILE_OCR 86
+
+volatile uint16_t profile_hist[PROFILE_BUCKETS];
+volatile uint16_t profile_samples;
+volatile uint16_t profile_outside;		// samples beyond the last bucket
+volatile uint16_t profile_pc;			// word address the sample interrupt returns to
+uint8_t profile_shift;					// log2 of the instruction words per bucket
+
+// End of the code in flash, from the linker script
+extern char _etext[];
+
+static inline void profile_init(void) {
+	uint16_t words = (uint16_t)_etext / 2;
+	while ((words - 1) >> profile_shift >= PROFILE_BUCKETS)
+		profile_shift++;
+
+	TCCR2A = (1 << WGM21);
+	TCCR2B = (1 << CS22) | (1 << CS21) | (1 << CS20);
+	OCR2A = PROFILE_OCR;
+	TIMSK2 |= (1 << OCIE2A);
+}
+
+// The vector only saves the registers it uses, picks the return address off the stack, where
+// the CPU pushed it low byte first, and continues in the handler below, which returns with reti
+// like any ISR. None of these instructions change SREG.
+ISR(TIMER2_COMPA_vect, ISR_NAKED) {
+	__asm__ __volatile__ (
+		"push r30"				"\n\t"
+		"push r31"				"\n\t"
+		"in r30, __SP_L__"		"\n\t"
+		"in r31, __SP_H__"		"\n\t"
+		"push r0"				"\n\t"
+		"ldd r0, Z+3"			"\n\t"		// high byte, above the 2 registers pushed
+		"sts profile_pc+1, r0"	"\n\t"
+		"ldd r0, Z+4"			"\n\t"
+		"sts profile_pc, r0"	"\n\t"
+		"pop r0"				"\n\t"
+		"pop r31"				"\n\t"
+		"pop r30"				"\n\t"
+		"jmp __vector_profile_sample"	"\n\t"
+	);
+}
+
+void __vector_profile_sample(void) __attribute__((signal, used));
+void __vector_profile_sample(void) {
+	uint16_t bucket = profile_pc >> profile_shift;
+
+	profile_samples++;
+	if (bucket >= PROFILE_BUCKETS)
+		profile_outside++;
+	else if (profile_hist[bucket] != 0xffff)
+		profile_hist[bucket]++;
+}
+
+// Sends the histogram and starts it over. Each counter is taken and cleared at once, so no
+// sample is lost.
+static uint16_t profile_task(uint8_t unused) {
+	static uint8_t calls = 0;
+	(void)unused;
+
+	// 250 ms at a time, the scheduler cannot wait for longer than 455 ms
+	if (++calls < PROFILE_DUMP_S * 4)
+		return 250 * SCHED_TICKS_PER_MS;
+	calls = 0;
+
+	uint16_t samples, outside;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		samples = profile_samples;
+		outside = profile_outside;
+		profile_samples = profile_outside = 0;
+	}
+	LOG("##### Profile: %u samples, %u bytes per bucket, %u outside\n",
+		samples, 2 << profile_shift, outside);
+
+	for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+		uint16_t count;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			count = profile_hist[b];
+			profile_hist[b] = 0;
+		}
+		if (count)
+			LOG("##### Profile: bucket %u samples %u\n", b, count);
+	}
+	LOG("##### Profile: end\n");
+	return 250 * SCHED_TICKS_PER_MS;
+}
+
+#else
+
+#define PROFILE_TASKS 0
+
+static inline void profile_init(void) {
+}
+
+static inline uint16_t profile_task(uint8_t unused) {
+	(void)unused;
+	return 0x7fff;
+}
+
+#endif // PROFILE && __AVR__
+
+#endif // PROFILE_H
@@ -0,0 +1,133 @@
+// Name: ring.h
+//
+// Lock-free circular queue for passing items between main() and an interrupt service routine,
+// or between any one producer and one consumer. This is the queue described in the article,
+// written once so that a program can have as many of them, of as many item types, as it needs:
+//
+//   RING_DEFINE(RGBQueue, RGB, 128)
+//
+// defines the type RGBQueue and the functions RGBQueue_empty(), RGBQueue_full(),
+// RGBQueue_count(), RGBQueue_enqueue(), RGBQueue_dequeue() and RGBQueue_peek(), which all take
+// a pointer to the queue. A zero-initialised queue (e.g. a global) is empty.
+//
+// The rules are the same as before. Only the producer writes tail, only the consumer writes
+// head, and both are a uint8_t, so they are always read and written in a single instruction
+// (the queue length can be at most 256). One slot is always left empty, so that head == tail
+// means empty rather than full. enqueue() must not be called on a full queue and only by the
+// producer; dequeue() and peek() must not be called on an empty queue and only by the consumer.
+//
+// The item is written before tail is advanced, and read before head is advanced. On the AVR
+// the indices are volatile and a compiler barrier keeps the (non-volatile) item accesses on the
+// right side of them. A host build has to deal with a weakly ordered CPU as well, so there the
+// indices are loaded with acquire and stored with release semantics. Each side only reads the
+// other side's index, since it already knows its own. tools/interleave checks these orderings.
+// A host consumer of many rings can sleep until any of them has items with tools/ringset.h.
+//
+// The items are stored as an array of structs. RING_DEFINE_SOA() stores them as a struct of
+// arrays instead, one plane per member, for consumers that work on one channel at a time. It
+// needs the members listed in an X macro that passes its second argument on:
+//
+//   #define RGB_FIELDS(X, a) X(uint8_t, r, a) X(uint8_t, g, a) X(uint8_t, b, a)
+//   RING_DEFINE_SOA(RGBPlanes, RGB, RGB_FIELDS, 128)
+//
+// which defines RGBPlanes with the planes r[128], g[128] and b[128] and the same functions,
+// except that peek() copies the item into its second argument, as there is no item to point
+// to. A consumer can also read the planes directly, from index head on. tools/layout compares
+// the speed of both layouts on the host, layout.c on the AVR.
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+#if defined(__AVR__)
+#define RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+#define RING_LOAD_ACQUIRE(x) __extension__ ({ uint8_t v_ = (x); RING_BARRIER(); v_; })
+#define RING_STORE_RELEASE(x, v) do { RING_BARRIER(); (x) = (v); } while (0)
+#else
+#define RING_LOAD_ACQUIRE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define RING_STORE_RELEASE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#endif
+
+// The functions that only deal with the indices, shared by both layouts
+#define RING_DEFINE_INDICES_(name, length)											\
+	typedef char name##_length_check[(length) <= 256 ? 1 : -1];						\
+																					\
+	/* Returns 1 if the queue is empty, 0 otherwise (consumer side) */				\
+	static inline uint8_t name##_empty(name *q) {									\
+		return RING_LOAD_ACQUIRE(q->tail) == q->head;								\
+	}																				\
+																					\
+	/* Returns 1 if the queue is full, 0 otherwise (producer side) */				\
+	static inline uint8_t name##_full(name *q) {									\
+		return RING_LOAD_ACQUIRE(q->head) == (q->tail + 1) % (length);				\
+	}																				\
+																					\
+	/* Returns the number of items on the queue. The other side may change it	\
+	   at any time, so for the consumer it is a lower bound and for the			\
+	   producer an upper bound. */													\
+	static inline uint8_t name##_count(name *q) {									\
+		uint8_t head = RING_LOAD_ACQUIRE(q->head);									\
+		uint8_t tail = RING_LOAD_ACQUIRE(q->tail);									\
+		return (tail + (length) - head) % (length);									\
+	}
+
+#define RING_DEFINE(name, type, length)												\
+	typedef struct {																\
+		type items[length];															\
+		volatile uint8_t head;		/* only ever modified by the consumer */		\
+		volatile uint8_t tail;		/* only ever modified by the producer */		\
+	} name;																			\
+																					\
+	RING_DEFINE_INDICES_(name, length)												\
+																					\
+	static inline void name##_enqueue(name *q, const type *item) {					\
+		uint8_t tail = q->tail;														\
+		q->items[tail] = *item;														\
+		RING_STORE_RELEASE(q->tail, (tail + 1) % (length));							\
+	}																				\
+																					\
+	static inline void name##_dequeue(name *q, type *item) {						\
+		uint8_t head = q->head;														\
+		*item = q->items[head];														\
+		RING_STORE_RELEASE(q->head, (head + 1) % (length));							\
+	}																				\
+																					\
+	/* The next item dequeue() would return, left on the queue */					\
+	static inline type *name##_peek(name *q) {										\
+		return &q->items[q->head];													\
+	}
+
+// Expansions of the member list for RING_DEFINE_SOA()
+#define RING_SOA_PLANE_(type, member, length)	type member[length];
+#define RING_SOA_PUT_(type, member, i)			q->member[i] = item->member;
+#define RING_SOA_GET_(type, member, i)			item->member = q->member[i];
+
+#define RING_DEFINE_SOA(name, type, fields, length)									\
+	typedef struct {																\
+		fields(RING_SOA_PLANE_, length)												\
+		volatile uint8_t head;		/* only ever modified by the consumer */		\
+		volatile uint8_t tail;		/* only ever modified by the producer */		\
+	} name;																			\
+																					\
+	RING_DEFINE_INDICES_(name, length)												\
+																					\
+	static inline void name##_enqueue(name *q, const type *item) {					\
+		uint8_t tail = q->tail;														\
+		fields(RING_SOA_PUT_, tail)													\
+		RING_STORE_RELEASE(q->tail, (tail + 1) % (length));							\
+	}																				\
+																					\
+	static inline void name##_dequeue(name *q, type *item) {						\
+		uint8_t head = q->head;														\
+		fields(RING_SOA_GET_, head)													\
+		RING_STORE_RELEASE(q->head, (head + 1) % (length));							\
+	}																				\
+																					\
+	/* Copies the next item dequeue() would return, leaving it on the queue */		\
+	static inline void name##_peek(name *q, type *item) {							\
+		uint8_t head = q->head;														\
+		fields(RING_SOA_GET_, head)													\
+	}
+
+#endif // RING_H
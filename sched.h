@@ -0,0 +1,80 @@
+// Name: sched.h
+//
+// A tiny run-to-completion scheduler for main(). Instead of busy waiting with _delay_ms(), a
+// task does a bounded piece of work and returns how many clock ticks it wants to wait before
+// it runs again, so that other tasks (e.g. producers for other queues) can use that time.
+//
+// The clock is Timer 1 running freely at CLK_io / 256, which is 72 ticks per ms at 18.432MHz.
+// Each task counts down the ticks until it is due, by the ticks that passed since the last
+// pass over the tasks. A task that ISRs keep from running for a long time is then simply
+// overdue, where a wake-up tick compared with wrap-around arithmetic would look far ahead
+// after 455 ms and make it wait for the clock to come round again. A task may ask to wait at
+// most 32767 ticks (455 ms at 18.432MHz). Tasks must never block; a producer that finds its
+// queue full simply asks to be run again a tick later.
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#define SCHED_TICKS_PER_MS (F_CPU / 256 / 1000)
+
+// Called with the number of ticks until the next task is due, when there is nothing to do
+// before then. The host simulator uses this to let its virtual time pass, on the AVR it does
+// nothing, but it would be the place to put the CPU to sleep.
+#ifndef SCHED_IDLE
+#define SCHED_IDLE(ticks)
+#endif
+
+struct _Task {
+	uint16_t (*run)(uint8_t arg);	// returns the number of ticks until it wants to run again
+	uint8_t arg;					// passed to run(), e.g. which queue the task works on
+	uint16_t wait;					// ticks until the task runs next, 0 when due
+};
+typedef struct _Task Task;
+
+// Starts Timer 1 as the scheduler clock
+static inline void sched_init(void) {
+	TCCR1A = 0;
+	TCCR1B = (1 << CS12);			// CLK_io / 256
+}
+
+// The current tick. TCNT1 is read through the shared TEMP register, which ISRs may use too.
+static inline uint16_t sched_now(void) {
+	uint16_t now;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		now = TCNT1;
+	}
+	return now;
+}
+
+// Runs the tasks forever, each one whenever it is due, in the order given
+static inline void sched_run(Task *tasks, uint8_t count) {
+	uint16_t last = sched_now();
+
+	for (;;) {
+		uint16_t now = sched_now();
+		uint16_t elapsed = now - last;
+		uint16_t idle = INT16_MAX;
+		last = now;
+
+		for (uint8_t i = 0; i < count; i++) {
+			Task *task = &tasks[i];
+
+			task->wait = task->wait > elapsed ? task->wait - elapsed : 0;
+			if (!task->wait)
+				task->wait = task->run(task->arg);
+			if (task->wait < idle)
+				idle = task->wait;
+		}
+
+		// The waits count from the start of the pass
+		uint16_t spent = sched_now() - now;
+		if (idle > spent)
+			SCHED_IDLE(idle - spent);
+	}
+}
+
+#endif // SCHED_H
@@ -0,0 +1,382 @@
+// Name: spi_link.c
+//
+// The producer/consumer example from main.c split over two boards, for when several
+// controllers are chained. The sender's queue is drained over SPI by its SPI interrupt, and
+// the receiver's SPI interrupt is the producer of its own queue, so the items go from one
+// board's queue to the next one's without main() on either side waiting for the link.
+//
+// Framing: every item goes as FLAG, r, g, b, CRC-8 of r, g and b. A FLAG or ESC among the
+// other bytes is sent as ESC followed by the byte XOR 0x20, so FLAG only ever starts a frame
+// and the receiver finds the next frame after any corrupted or lost byte. Frames with a bad
+// CRC are counted and dropped.
+//
+// Flow control: the receiver drives BUSY (PB1, wired to PB1 on the sender) high while its
+// queue holds BUSY_LEVEL items or more, and low again once its consumer has brought it down to
+// READY_LEVEL. The sender looks at BUSY before each frame, so the room above BUSY_LEVEL only
+// has to take the frames that were already on their way when BUSY went high.
+//
+// The same file builds both boards, the sender with SPI_LINK_SENDER defined:
+//
+//   make TARGET=spi_link DEFS=-DSPI_LINK_SENDER      the SPI master, which produces
+//   make TARGET=spi_link                              the SPI slave, which consumes
+//
+// and they are wired SCK, MOSI, SS (held low by the sender) and PB1 to the same pins of the
+// other board, with a common ground. The sender has the pull-up on PB1, so a receiver that has
+// not started yet reads as busy. Both print the items per second every REPORT_MS. The
+// receiver checks that the colours arrive in order, and counts gaps. Its consumer spends
+// CONSUMER_WORK_US on each item, so a slow one can be tried out against the link.
+//
+// On the host, tools/pair runs the two simulator builds wired together:
+//
+//   make -C host TARGET=spi_link DEFS=-DSPI_LINK_SENDER BUILD=build/spi_sender
+//   make -C host TARGET=spi_link BUILD=build/spi_receiver
+//   tools/pair -s 2 host/build/spi_sender/spi_link host/build/spi_receiver/spi_link
+//
+// which gives, at 18.432 MHz on the simulator, which charges every interrupt SIM_ISR_CYCLES
+// instead of the cycles its code takes:
+//
+//   SPI_DIVIDER=64   5160 items/s
+//   SPI_DIVIDER=16  11000 items/s
+//
+// with no overruns, bad frames, gaps or drops. A frame is mostly 5 bytes, 2560 cycles at
+// CLK_io / 64, and the sender's interrupt before each byte adds the rest. With
+// DEFS=-DCONSUMER_WORK_US=500 on the receiver BUSY holds the sender back to 1760 items/s,
+// what the consumer manages with the receiver's interrupts taking their share, and still
+// nothing is lost.
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+
+// Only main() prints, so that the SPI interrupt is never held off for the length of a line
+#define LOG_SINGLE_CONTEXT
+#include "example.h"
+#include "log.h"
+#include "ring.h"
+#include "sched.h"
+
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 64
+#endif
+
+// The receiver asks the sender to stop at BUSY_LEVEL queued items, and to go on at READY_LEVEL
+#ifndef BUSY_LEVEL
+#define BUSY_LEVEL (QUEUE_LENGTH - 8)
+#endif
+
+#ifndef READY_LEVEL
+#define READY_LEVEL (QUEUE_LENGTH / 2)
+#endif
+
+// Time the receiver's consumer spends on each item, standing in for real work
+#ifndef CONSUMER_WORK_US
+#define CONSUMER_WORK_US 0
+#endif
+
+// SCK is CLK_io divided by 16, 64 or 128. The receiver's interrupt has to be done with a byte
+// before the next one is in, which the sender starts from its own interrupt once the one before
+// has gone out. At CLK_io / 4 a byte takes 32 cycles, and the sender's interrupt adds some 60,
+// but the receiver's interrupt needs about 100 for every byte: the CRC it works out at the end
+// of a frame makes avr-gcc save most registers on every entry. CLK_io / 16 leaves it about 190.
+// These are estimates from the code, not measured on a chip. The simulator charges every
+// interrupt the same SIM_ISR_CYCLES, so it would not show the overruns.
+#ifndef SPI_DIVIDER
+#define SPI_DIVIDER 64
+#endif
+
+#if SPI_DIVIDER == 16
+#define SPI_RATE (1 << SPR0)
+#elif SPI_DIVIDER == 64
+#define SPI_RATE (1 << SPR1)
+#elif SPI_DIVIDER == 128
+#define SPI_RATE ((1 << SPR1) | (1 << SPR0))
+#else
+#error "SPI_DIVIDER must be 16, 64 or 128, the receiver cannot keep up with CLK_io / 4"
+#endif
+
+// Print the throughput every this many ms, at most 455 (see sched.h)
+#ifndef REPORT_MS
+#define REPORT_MS 250
+#endif
+
+#define BUSY_PIN PB1
+
+#define FLAG	0x7e
+#define ESC		0x7d
+#define ESC_XOR	0x20
+
+// FLAG, and r, g, b and the CRC, each of which may be escaped
+#define FRAME_MAX (1 + 2 * 4)
+
+RING_DEFINE(RGBQueue, RGB, QUEUE_LENGTH)
+
+RGBQueue queue;
+
+// CRC-8 with the polynomial x^8 + x^2 + x + 1
+static uint8_t crc8(const uint8_t *data, uint8_t len) {
+	uint8_t crc = 0;
+	while (len--) {
+		crc ^= *data++;
+		for (uint8_t bit = 0; bit < 8; bit++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+// Items per second over the ticks since the last call
+static uint16_t items_per_s(uint16_t items) {
+	static uint16_t last_items, last_tick;
+
+	uint16_t now = sched_now();
+	uint16_t ticks = now - last_tick;
+	uint16_t rate = (uint16_t)(items - last_items) * (SCHED_TICKS_PER_MS * 1000UL) / ticks;
+	last_items = items;
+	last_tick = now;
+	return rate;
+}
+
+#ifdef SPI_LINK_SENDER
+
+// Set by the ISR when it stops sending, cleared by link_start()
+volatile uint8_t link_idle = 1;
+
+// Only ever modified by the ISR
+volatile uint16_t items_sent = 0;
+volatile uint16_t stalls = 0;		// times the receiver was busy when a frame was due
+
+// The frame being sent
+static uint8_t frame[FRAME_MAX];
+static uint8_t frame_len, frame_pos;
+
+// Master, SS held low so the receiver is always selected. BUSY is an input with the pull-up on,
+// so the sender waits until the receiver is up and drives it low.
+static void SPI_Init(void) {
+	DDRB |= (1 << PB2) | (1 << PB3) | (1 << PB5);
+	PORTB = (PORTB & ~(1 << PB2)) | (1 << BUSY_PIN);
+	SPCR = (1 << SPIE) | (1 << SPE) | (1 << MSTR) | SPI_RATE;
+	sei();
+}
+
+static inline void put_escaped(uint8_t byte) {
+	if (byte == FLAG || byte == ESC) {
+		frame[frame_len++] = ESC;
+		byte ^= ESC_XOR;
+	}
+	frame[frame_len++] = byte;
+}
+
+// Dequeues the next item into frame
+static void load_frame(void) {
+	RGB rgb;
+	RGBQueue_dequeue(&queue, &rgb);
+
+	uint8_t crc = crc8(&rgb.r, 3);
+	frame_len = 0;
+	frame[frame_len++] = FLAG;
+	put_escaped(rgb.r);
+	put_escaped(rgb.g);
+	put_escaped(rgb.b);
+	put_escaped(crc);
+	frame_pos = 0;
+}
+
+// Called after each byte. Between frames it stops when the queue is empty or the receiver is
+// busy, and main() starts it again.
+ISR(SPI_STC_vect) {
+	if (frame_pos < frame_len) {
+		SPDR = frame[frame_pos++];
+		return;
+	}
+	items_sent++;
+
+	if (RGBQueue_empty(&queue)) {
+		link_idle = 1;
+		return;
+	}
+	if (PINB & (1 << BUSY_PIN)) {
+		stalls++;
+		link_idle = 1;
+		return;
+	}
+	load_frame();
+	SPDR = frame[frame_pos++];
+}
+
+// Sends the next frame if the ISR has stopped, there is one and the receiver can take it. The
+// ISR does not run while the link is idle.
+static void link_start(void) {
+	if (!link_idle || RGBQueue_empty(&queue) || (PINB & (1 << BUSY_PIN)))
+		return;
+	link_idle = 0;
+	load_frame();
+	SPDR = frame[frame_pos++];
+}
+
+// The colour the next item has
+static RGB next_rgb;
+
+// The producer keeps the queue full
+static uint16_t produce(uint8_t unused) {
+	(void)unused;
+
+	while (!RGBQueue_full(&queue)) {
+		RGBQueue_enqueue(&queue, &next_rgb);
+
+		// Count through all 2^24 colors like main.c does
+		if (++next_rgb.b == 0 && ++next_rgb.g == 0)
+			++next_rgb.r;
+	}
+	link_start();
+
+	// Have another look on the next tick
+	return 1;
+}
+
+static uint16_t report(uint8_t unused) {
+	(void)unused;
+
+	uint16_t items, stopped;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		items = items_sent;
+		stopped = stalls;
+	}
+	LOG("##### Sender: items/s %u stalls %u queue %u\n",
+		items_per_s(items), stopped, RGBQueue_count(&queue));
+	return REPORT_MS * SCHED_TICKS_PER_MS;
+}
+
+#else
+
+// Only ever modified by the ISR
+volatile uint16_t bad_frames = 0;	// wrong CRC, or cut short by a FLAG
+volatile uint16_t dropped = 0;		// good frames that found the queue full
+
+// Only ever modified by the consumer
+uint16_t items_received = 0;
+uint16_t gaps = 0;					// items that did not follow the one before
+
+// Slave, MISO and BUSY outputs
+static void SPI_Init(void) {
+	DDRB |= (1 << PB4) | (1 << BUSY_PIN);
+	SPCR = (1 << SPIE) | (1 << SPE);
+	sei();
+}
+
+// The producer, called after each byte. It unescapes the bytes of a frame, and enqueues the
+// item once all 4 are in and the CRC matches.
+ISR(SPI_STC_vect) {
+	static uint8_t payload[4];
+	static uint8_t pos = sizeof(payload);	// no frame until the first FLAG
+	static uint8_t escaped = 0;
+
+	uint8_t byte = SPDR;
+	if (byte == FLAG) {
+		if (pos && pos < sizeof(payload))
+			bad_frames++;
+		pos = 0;
+		escaped = 0;
+		return;
+	}
+	if (pos == sizeof(payload))
+		return;
+	if (byte == ESC) {
+		escaped = 1;
+		return;
+	}
+	if (escaped) {
+		byte ^= ESC_XOR;
+		escaped = 0;
+	}
+
+	payload[pos++] = byte;
+	if (pos < sizeof(payload))
+		return;
+
+	if (crc8(payload, 3) != payload[3]) {
+		bad_frames++;
+		return;
+	}
+	if (RGBQueue_full(&queue)) {
+		dropped++;
+		return;
+	}
+	RGB rgb = { payload[0], payload[1], payload[2] };
+	RGBQueue_enqueue(&queue, &rgb);
+
+	// Set and cleared with sbi and cbi, so this and the consumer cannot undo each other's bit
+	if (RGBQueue_count(&queue) >= BUSY_LEVEL)
+		PORTB |= (1 << BUSY_PIN);
+}
+
+// The colour the next item should have
+static RGB expected;
+
+// The consumer takes what is in the queue, and tells the sender to go on once it is low enough.
+// It leaves what arrives meanwhile to its next run, so it stays bounded with a slow consumer.
+static uint16_t consume(uint8_t unused) {
+	(void)unused;
+
+	for (uint8_t n = RGBQueue_count(&queue); n; n--) {
+		RGB rgb;
+		RGBQueue_dequeue(&queue, &rgb);
+		items_received++;
+
+		if (rgb.r != expected.r || rgb.g != expected.g || rgb.b != expected.b)
+			gaps++;
+		expected = rgb;
+		if (++expected.b == 0 && ++expected.g == 0)
+			++expected.r;
+
+		// The level only goes up by one at a time, so the ISR cannot have gone from here
+		// to BUSY_LEVEL in between
+		if (RGBQueue_count(&queue) <= READY_LEVEL)
+			PORTB &= ~(1 << BUSY_PIN);
+
+#if CONSUMER_WORK_US
+		_delay_us(CONSUMER_WORK_US);
+#endif
+	}
+
+	// Have another look on the next tick
+	return 1;
+}
+
+static uint16_t report(uint8_t unused) {
+	(void)unused;
+
+	uint16_t bad, lost;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		bad = bad_frames;
+		lost = dropped;
+	}
+	LOG("##### Receiver: items/s %u bad frames %u dropped %u gaps %u queue %u busy %u\n",
+		items_per_s(items_received), bad, lost, gaps, RGBQueue_count(&queue),
+		(PORTB >> BUSY_PIN) & 1);
+	return REPORT_MS * SCHED_TICKS_PER_MS;
+}
+
+#endif
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+#ifdef SPI_LINK_SENDER
+	LOG("SPI Link Sender\n\n");
+#else
+	LOG("SPI Link Receiver\n\n");
+#endif
+
+	sched_init();
+	SPI_Init();
+
+#ifdef SPI_LINK_SENDER
+	static Task tasks[] = { { produce, 0, 0 }, { report, 0, REPORT_MS * SCHED_TICKS_PER_MS } };
+#else
+	static Task tasks[] = { { consume, 0, 0 }, { report, 0, REPORT_MS * SCHED_TICKS_PER_MS } };
+#endif
+	sched_run(tasks, 2);
+
+	return 0;
+}
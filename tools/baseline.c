@@ -0,0 +1,345 @@
+// Name: baseline.c
+//
+// Host benchmark of ring.h against the usual ways of passing items between two threads, to
+// show what the lock-free queue saves. The same producer and consumer run over
+//
+//   ring     RING_DEFINE() as in main.c, lock-free, each side polls while it has to wait
+//   spin     the same circular buffer behind a spinlock, each side polls while it has to wait
+//   mutex    the same circular buffer behind a mutex, each side sleeps on a condition
+//            variable while it has to wait and the other side signals it
+//
+// All three hold 255 items, so the producer waits for room in the same places. The mutex queue
+// is the pthread version of std::mutex, std::condition_variable and a bounded std::deque.
+//
+// The scenarios are
+//
+//   flood    -n items enqueued back to back, the most each queue can pass
+//   <trace>  a producer timing trace from host/traces, one delay in ms per item, with each ms
+//            taken as -u us so a run stays short. It is replayed -c times.
+//
+// The producer stamps every item with the time just before its enqueue, and the consumer takes
+// the latency right after its dequeue. The report gives items per second over the whole run,
+// and the median, 99th and 99.9th percentile and maximum latency in us. The consumer also
+// checks that the items arrive in order.
+//
+// A polling side gives the CPU away with sched_yield() on every poll, as the other side may
+// have to run on the same CPU to make progress. On a host with several CPUs, where both
+// run at once, that is a system call that returns right away. With a single CPU the threads
+// take turns, the spinlock is then hardly ever found taken and comes close to the ring.
+//
+// Usage: baseline [-n items] [-u us] [-c cycles] [trace...]
+//   e.g. tools/baseline host/traces/*.trace
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../ring.h"
+
+struct _Item {
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+	uint64_t stamp;		// ns, when the producer enqueued it
+};
+typedef struct _Item Item;
+
+#define LENGTH 256
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The lock-free queue
+
+RING_DEFINE(ItemRing, Item, LENGTH)
+
+static ItemRing ring;
+
+static void ring_init(void) {
+	ring.head = ring.tail = 0;
+}
+
+static void ring_put(const Item *item) {
+	while (ItemRing_full(&ring))
+		sched_yield();
+	ItemRing_enqueue(&ring, item);
+}
+
+static void ring_get(Item *item) {
+	while (ItemRing_empty(&ring))
+		sched_yield();
+	ItemRing_dequeue(&ring, item);
+}
+
+// The spinlock queue
+
+static struct {
+	Item items[LENGTH];
+	unsigned head, tail;
+	uint8_t lock;
+} spin;
+
+static void spin_lock(void) {
+	while (__atomic_test_and_set(&spin.lock, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+static void spin_unlock(void) {
+	__atomic_clear(&spin.lock, __ATOMIC_RELEASE);
+}
+
+static void spin_init(void) {
+	spin.head = spin.tail = 0;
+	spin.lock = 0;
+}
+
+static void spin_put(const Item *item) {
+	for (;;) {
+		spin_lock();
+		if ((spin.tail + 1) % LENGTH != spin.head)
+			break;
+		spin_unlock();
+		sched_yield();
+	}
+	spin.items[spin.tail] = *item;
+	spin.tail = (spin.tail + 1) % LENGTH;
+	spin_unlock();
+}
+
+static void spin_get(Item *item) {
+	for (;;) {
+		spin_lock();
+		if (spin.head != spin.tail)
+			break;
+		spin_unlock();
+		sched_yield();
+	}
+	*item = spin.items[spin.head];
+	spin.head = (spin.head + 1) % LENGTH;
+	spin_unlock();
+}
+
+// The mutex and condition variable queue
+
+static struct {
+	Item items[LENGTH];
+	unsigned head, tail;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full;
+} locked = { .lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER,
+			 .not_full = PTHREAD_COND_INITIALIZER };
+
+static void mutex_init(void) {
+	locked.head = locked.tail = 0;
+}
+
+static void mutex_put(const Item *item) {
+	pthread_mutex_lock(&locked.lock);
+	while ((locked.tail + 1) % LENGTH == locked.head)
+		pthread_cond_wait(&locked.not_full, &locked.lock);
+	locked.items[locked.tail] = *item;
+	locked.tail = (locked.tail + 1) % LENGTH;
+	pthread_cond_signal(&locked.not_empty);
+	pthread_mutex_unlock(&locked.lock);
+}
+
+static void mutex_get(Item *item) {
+	pthread_mutex_lock(&locked.lock);
+	while (locked.head == locked.tail)
+		pthread_cond_wait(&locked.not_empty, &locked.lock);
+	*item = locked.items[locked.head];
+	locked.head = (locked.head + 1) % LENGTH;
+	pthread_cond_signal(&locked.not_full);
+	pthread_mutex_unlock(&locked.lock);
+}
+
+struct queue {
+	const char *name;
+	void (*init)(void);
+	void (*put)(const Item *item);
+	void (*get)(Item *item);
+};
+
+static const struct queue queues[] = {
+	{ "ring", ring_init, ring_put, ring_get },
+	{ "spin", spin_init, spin_put, spin_get },
+	{ "mutex", mutex_init, mutex_put, mutex_get },
+};
+
+#define NELEMS(x) (sizeof(x)/sizeof((x)[0]))
+
+// One run of a scenario over a queue
+struct run {
+	const struct queue *queue;
+	const uint8_t *delays;		// ms before each item, NULL to flood
+	size_t delays_len;
+	size_t items;
+	uint64_t us_per_ms;
+	uint32_t *latency;			// ns, one per item
+	size_t out_of_order;
+};
+
+static void *producer(void *arg) {
+	struct run *run = arg;
+	uint64_t next = now_ns();
+
+	for (size_t i = 0; i < run->items; i++) {
+		if (run->delays) {
+			uint8_t ms = run->delays[i % run->delays_len];
+			if (ms) {
+				next += ms * run->us_per_ms * 1000;
+				struct timespec ts = { next / 1000000000, next % 1000000000 };
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			}
+		}
+		Item item = { i, i >> 8, i >> 16, now_ns() };
+		run->queue->put(&item);
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg) {
+	struct run *run = arg;
+
+	for (size_t i = 0; i < run->items; i++) {
+		Item item;
+		run->queue->get(&item);
+		uint64_t latency = now_ns() - item.stamp;
+		run->latency[i] = latency < UINT32_MAX ? latency : UINT32_MAX;
+		if (item.r != (uint8_t)i || item.g != (uint8_t)(i >> 8) || item.b != (uint8_t)(i >> 16))
+			run->out_of_order++;
+	}
+	return NULL;
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Latency at the given percentile in us, of the sorted latencies
+static double percentile(const uint32_t *sorted, size_t n, double p) {
+	size_t i = (size_t)(n * p / 100);
+	return sorted[i < n ? i : n - 1] / 1000.0;
+}
+
+static void measure(struct run *run, const char *scenario) {
+	run->queue->init();
+	run->out_of_order = 0;
+
+	pthread_t threads[2];
+	uint64_t start = now_ns();
+	if (pthread_create(&threads[0], NULL, consumer, run) ||
+		pthread_create(&threads[1], NULL, producer, run)) {
+		fprintf(stderr, "baseline: cannot create threads\n");
+		exit(1);
+	}
+	pthread_join(threads[1], NULL);
+	pthread_join(threads[0], NULL);
+	double seconds = (now_ns() - start) / 1e9;
+
+	qsort(run->latency, run->items, sizeof(run->latency[0]), compare_u32);
+	printf("%-6s %-10s %11.0f %9.2f %9.2f %9.2f %9.2f", run->queue->name, scenario,
+		   run->items / seconds, percentile(run->latency, run->items, 50),
+		   percentile(run->latency, run->items, 99), percentile(run->latency, run->items, 99.9),
+		   run->latency[run->items - 1] / 1000.0);
+	if (run->out_of_order)
+		printf("   %zu out of order", run->out_of_order);
+	printf("\n");
+}
+
+// Reads a trace in the format of host/traces, see SIM_TRACE in host/sim.c
+static uint8_t *load_trace(const char *path, size_t *len) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+
+	size_t cap = 1024;
+	uint8_t *trace = malloc(cap);
+	char line[64];
+	*len = 0;
+	while (fgets(line, sizeof(line), f)) {
+		char *end;
+		long ms = strtol(line, &end, 10);
+		if (end == line || line[0] == '#')
+			continue;
+		if (ms < 0 || ms > 255) {
+			fprintf(stderr, "baseline: %s: delay %ld out of range\n", path, ms);
+			exit(1);
+		}
+		if (*len == cap)
+			trace = realloc(trace, cap *= 2);
+		trace[(*len)++] = ms;
+	}
+	fclose(f);
+	if (!*len) {
+		fprintf(stderr, "baseline: %s: no delays\n", path);
+		exit(1);
+	}
+	return trace;
+}
+
+// The file name without directory and extension
+static const char *scenario_name(const char *path) {
+	static char name[64];
+	const char *base = strrchr(path, '/');
+	snprintf(name, sizeof(name), "%s", base ? base + 1 : path);
+	char *dot = strrchr(name, '.');
+	if (dot && dot != name)
+		*dot = '\0';
+	return name;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: baseline [-n items] [-u us] [-c cycles] [trace...]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	long items = 1000000, us_per_ms = 100, cycles = 5;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:u:c:")) != -1) {
+		switch (opt) {
+		case 'n': items = atol(optarg); break;
+		case 'u': us_per_ms = atol(optarg); break;
+		case 'c': cycles = atol(optarg); break;
+		default: usage();
+		}
+	}
+	if (items <= 0 || us_per_ms <= 0 || cycles <= 0)
+		usage();
+
+	printf("queue  scenario       items/s       p50       p99     p99.9       max   (latency in us)\n");
+	struct run run = { .items = items, .us_per_ms = us_per_ms };
+	run.latency = malloc(items * sizeof(run.latency[0]));
+	for (size_t q = 0; q < NELEMS(queues); q++) {
+		run.queue = &queues[q];
+		measure(&run, "flood");
+	}
+
+	for (int i = optind; i < argc; i++) {
+		size_t len;
+		uint8_t *trace = load_trace(argv[i], &len);
+		struct run replay = { .delays = trace, .delays_len = len, .items = len * cycles,
+							  .us_per_ms = us_per_ms };
+		replay.latency = malloc(replay.items * sizeof(replay.latency[0]));
+		for (size_t q = 0; q < NELEMS(queues); q++) {
+			replay.queue = &queues[q];
+			measure(&replay, scenario_name(argv[i]));
+		}
+		free(replay.latency);
+		free(trace);
+	}
+	return 0;
+}
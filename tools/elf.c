@@ -0,0 +1,176 @@
+// Name: elf.c
+//
+// See elf.h
+
+#include <elf.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+
+int elf_open(struct elf *elf, const char *path) {
+	memset(elf, 0, sizeof(*elf));
+	elf->path = path;
+
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	rewind(f);
+	elf->data = malloc(size > 0 ? size : 1);
+	elf->size = fread(elf->data, 1, size > 0 ? size : 0, f);
+	fclose(f);
+
+	const unsigned char *ident = elf->data;
+	if (elf->size < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG) != 0 ||
+		ident[EI_DATA] != ELFDATA2LSB) {
+		fprintf(stderr, "%s: not a little endian ELF file\n", path);
+		elf_close(elf);
+		return -1;
+	}
+	elf->is64 = ident[EI_CLASS] == ELFCLASS64;
+
+	if (elf->is64 && elf->size >= sizeof(Elf64_Ehdr)) {
+		Elf64_Ehdr eh;
+		memcpy(&eh, elf->data, sizeof(eh));
+		elf->shoff = eh.e_shoff;
+		elf->shnum = eh.e_shnum;
+		elf->shentsize = eh.e_shentsize;
+		elf->shstrndx = eh.e_shstrndx;
+	} else if (!elf->is64 && elf->size >= sizeof(Elf32_Ehdr)) {
+		Elf32_Ehdr eh;
+		memcpy(&eh, elf->data, sizeof(eh));
+		elf->shoff = eh.e_shoff;
+		elf->shnum = eh.e_shnum;
+		elf->shentsize = eh.e_shentsize;
+		elf->shstrndx = eh.e_shstrndx;
+	}
+
+	if (!elf->shoff || elf->shoff + (uint64_t)elf->shnum * elf->shentsize > elf->size) {
+		fprintf(stderr, "%s: no section headers\n", path);
+		elf_close(elf);
+		return -1;
+	}
+	return 0;
+}
+
+void elf_close(struct elf *elf) {
+	free(elf->data);
+	elf->data = NULL;
+}
+
+// Raw section header, without a name
+static int section_header(const struct elf *elf, unsigned index, struct elf_section *s,
+						  uint32_t *name) {
+	if (index >= elf->shnum)
+		return -1;
+	const unsigned char *p = elf->data + elf->shoff + (uint64_t)index * elf->shentsize;
+	uint64_t offset;
+
+	if (elf->is64) {
+		Elf64_Shdr sh;
+		memcpy(&sh, p, sizeof(sh));
+		*name = sh.sh_name;
+		s->type = sh.sh_type;
+		s->addr = sh.sh_addr;
+		offset = sh.sh_offset;
+		s->size = sh.sh_size;
+		s->link = sh.sh_link;
+		s->entsize = sh.sh_entsize;
+	} else {
+		Elf32_Shdr sh;
+		memcpy(&sh, p, sizeof(sh));
+		*name = sh.sh_name;
+		s->type = sh.sh_type;
+		s->addr = sh.sh_addr;
+		offset = sh.sh_offset;
+		s->size = sh.sh_size;
+		s->link = sh.sh_link;
+		s->entsize = sh.sh_entsize;
+	}
+
+	s->data = NULL;
+	if (s->type != SHT_NOBITS && offset + s->size <= elf->size)
+		s->data = elf->data + offset;
+	return 0;
+}
+
+int elf_section(const struct elf *elf, unsigned index, struct elf_section *section) {
+	struct elf_section strtab;
+	uint32_t name, unused;
+
+	if (section_header(elf, index, section, &name) < 0 ||
+		section_header(elf, elf->shstrndx, &strtab, &unused) < 0 || !strtab.data ||
+		name >= strtab.size)
+		return -1;
+	section->name = (const char *)strtab.data + name;
+	return 0;
+}
+
+int elf_find_section(const struct elf *elf, const char *name, struct elf_section *section) {
+	for (unsigned i = 0; i < elf->shnum; i++)
+		if (elf_section(elf, i, section) == 0 && strcmp(section->name, name) == 0)
+			return 0;
+	return -1;
+}
+
+int elf_symbol(const struct elf *elf, const struct elf_section *symtab, size_t index,
+			   struct elf_symbol *symbol) {
+	size_t entsize = elf->is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+	struct elf_section strtab;
+	uint32_t name;
+
+	if (!symtab->data || (index + 1) * entsize > symtab->size ||
+		elf_section(elf, symtab->link, &strtab) < 0 || !strtab.data)
+		return -1;
+
+	const unsigned char *p = symtab->data + index * entsize;
+	if (elf->is64) {
+		Elf64_Sym sym;
+		memcpy(&sym, p, sizeof(sym));
+		name = sym.st_name;
+		symbol->value = sym.st_value;
+		symbol->size = sym.st_size;
+		symbol->type = ELF64_ST_TYPE(sym.st_info);
+	} else {
+		Elf32_Sym sym;
+		memcpy(&sym, p, sizeof(sym));
+		name = sym.st_name;
+		symbol->value = sym.st_value;
+		symbol->size = sym.st_size;
+		symbol->type = ELF32_ST_TYPE(sym.st_info);
+	}
+
+	symbol->name = name < strtab.size ? (const char *)strtab.data + name : "";
+	return 0;
+}
+
+static int by_address(const void *a, const void *b) {
+	const struct elf_symbol *sa = a, *sb = b;
+	return sa->value < sb->value ? -1 : sa->value > sb->value;
+}
+
+long elf_functions(const struct elf *elf, struct elf_symbol **functions) {
+	struct elf_section symtab;
+	struct elf_symbol sym;
+	long n = 0;
+
+	*functions = NULL;
+	if (elf_find_section(elf, ".symtab", &symtab) < 0) {
+		fprintf(stderr, "%s: no symbol table, was it stripped?\n", elf->path);
+		return -1;
+	}
+	for (size_t i = 0; elf_symbol(elf, &symtab, i, &sym) == 0; i++) {
+		if (sym.type != STT_FUNC || !sym.size)
+			continue;
+		*functions = realloc(*functions, (n + 1) * sizeof(**functions));
+		(*functions)[n++] = sym;
+	}
+	qsort(*functions, n, sizeof(**functions), by_address);
+	return n;
+}
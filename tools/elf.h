@@ -0,0 +1,56 @@
+// Name: elf.h
+//
+// Minimal reader for the ELF files the firmware is linked into, 32-bit (avr-gcc's main.elf) or
+// 64-bit (host builds), little endian only.
+
+#ifndef ELF_H
+#define ELF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct elf {
+	const char *path;
+	unsigned char *data;		// the whole file
+	size_t size;
+	int is64;
+	uint64_t shoff;				// section header table
+	unsigned shnum;
+	unsigned shentsize;
+	unsigned shstrndx;
+};
+
+struct elf_section {
+	const char *name;
+	uint32_t type;
+	uint64_t addr;
+	const unsigned char *data;	// NULL for sections without contents in the file
+	uint64_t size;
+	uint32_t link;
+	uint64_t entsize;
+};
+
+struct elf_symbol {
+	const char *name;
+	uint64_t value;
+	uint64_t size;
+	unsigned type;				// STT_FUNC, STT_OBJECT, ...
+};
+
+// Reads the file, prints an error and returns -1 if it is not an ELF file we can read
+int elf_open(struct elf *elf, const char *path);
+void elf_close(struct elf *elf);
+
+// Section by index or by name, return -1 if there is no such section
+int elf_section(const struct elf *elf, unsigned index, struct elf_section *section);
+int elf_find_section(const struct elf *elf, const char *name, struct elf_section *section);
+
+// Symbol by index in a symbol table section (e.g. .symtab), returns -1 past the last one
+int elf_symbol(const struct elf *elf, const struct elf_section *symtab, size_t index,
+			   struct elf_symbol *symbol);
+
+// The functions with a size in .symtab, sorted by address, in an array to free(). Prints an
+// error and returns -1 if there is no symbol table.
+long elf_functions(const struct elf *elf, struct elf_symbol **functions);
+
+#endif // ELF_H
@@ -0,0 +1,181 @@
+// Name: fanin.c
+//
+// Host benchmark of one consumer draining the rings of many producer threads, with the consumer
+// either polling every ring or waiting on all of them at once with ringset.h. Each of the -p
+// producers has a ring.h ring of its own and sends -n items in bursts of -b, sleeping -s us
+// after each burst. The consumer runs
+//
+//   poll     over all rings again and again, with sched_yield() after a round that found
+//            nothing, so that the producers get the CPU
+//   wait     over the rings ringset_wait() returns, arming each ring it has drained
+//
+// The report gives items per second, the CPU time the consumer used, its wake-ups through the
+// eventfd per 1000 items, and the median, 99th percentile and maximum latency from the
+// producer's enqueue to the consumer's dequeue in us. The consumer also checks that the items
+// of each producer arrive in order.
+//
+// Usage: fanin [-p producers] [-n items] [-b burst] [-s us]
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../ring.h"
+#include "ringset.h"
+
+struct _Item {
+	uint32_t seq;
+	uint64_t stamp;		// ns, when the producer enqueued it
+};
+typedef struct _Item Item;
+
+RING_DEFINE(ItemRing, Item, 256)
+
+static ItemRing rings[RINGSET_MAX];
+static RingSet set;
+
+static long producers = 8, items = 100000, burst = 64, sleep_us = 100;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *producer(void *arg) {
+	uint8_t ring = (uintptr_t)arg;
+	ItemRing *q = &rings[ring];
+	struct timespec pause = { sleep_us / 1000000, sleep_us % 1000000 * 1000 };
+
+	for (long i = 0; i < items; i++) {
+		while (ItemRing_full(q))
+			sched_yield();
+		Item item = { i, now_ns() };
+		ItemRing_enqueue(q, &item);
+		ringset_notify(&set, ring);
+
+		if ((i + 1) % burst == 0)
+			nanosleep(&pause, NULL);
+	}
+	return NULL;
+}
+
+// What the consumer has seen
+static uint32_t next_seq[RINGSET_MAX];
+static uint32_t *latency;		// ns, one per item
+static size_t received, out_of_order;
+
+static void drain(uint8_t ring) {
+	ItemRing *q = &rings[ring];
+	while (!ItemRing_empty(q)) {
+		Item item;
+		ItemRing_dequeue(q, &item);
+		uint64_t ns = now_ns() - item.stamp;
+		latency[received++] = ns < UINT32_MAX ? ns : UINT32_MAX;
+		if (item.seq != next_seq[ring]++)
+			out_of_order++;
+	}
+}
+
+static void consume_poll(size_t total) {
+	while (received < total) {
+		size_t before = received;
+		for (uint8_t ring = 0; ring < producers; ring++)
+			drain(ring);
+		if (received == before)
+			sched_yield();
+	}
+}
+
+static void consume_wait(size_t total) {
+	uint64_t all = producers == 64 ? UINT64_MAX : ((uint64_t)1 << producers) - 1;
+	uint64_t ready = all;
+
+	for (;;) {
+		uint64_t again = 0;
+		for (uint8_t ring = 0; ring < producers; ring++) {
+			if (!(ready & ((uint64_t)1 << ring)))
+				continue;
+			drain(ring);
+			ringset_arm(&set, ring);
+			if (!ItemRing_empty(&rings[ring]))
+				again |= (uint64_t)1 << ring;
+		}
+		if (received == total)
+			break;
+		ready = again ? again : ringset_wait(&set, -1);
+	}
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void measure(const char *mode, void (*consume)(size_t total)) {
+	size_t total = producers * items;
+	for (int ring = 0; ring < producers; ring++) {
+		rings[ring].head = rings[ring].tail = 0;
+		next_seq[ring] = 0;
+	}
+	received = out_of_order = 0;
+	if (ringset_init(&set) < 0)
+		exit(1);
+
+	pthread_t threads[RINGSET_MAX];
+	struct timespec cpu_start, cpu_end;
+	uint64_t start = now_ns();
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+	for (long ring = 0; ring < producers; ring++) {
+		if (pthread_create(&threads[ring], NULL, producer, (void *)(uintptr_t)ring)) {
+			fprintf(stderr, "fanin: cannot create threads\n");
+			exit(1);
+		}
+	}
+	consume(total);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+	double seconds = (now_ns() - start) / 1e9;
+	for (long ring = 0; ring < producers; ring++)
+		pthread_join(threads[ring], NULL);
+
+	double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+	qsort(latency, total, sizeof(latency[0]), compare_u32);
+	printf("%-6s %11.0f %9.3f %9.2f %9.2f %9.2f %9.2f", mode, total / seconds, cpu,
+		   set.wakeups * 1000.0 / total, latency[total / 2] / 1000.0,
+		   latency[total * 99 / 100] / 1000.0, latency[total - 1] / 1000.0);
+	if (out_of_order)
+		printf("   %zu out of order", out_of_order);
+	printf("\n");
+	ringset_close(&set);
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: fanin [-p producers] [-n items] [-b burst] [-s us]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "p:n:b:s:")) != -1) {
+		switch (opt) {
+		case 'p': producers = atol(optarg); break;
+		case 'n': items = atol(optarg); break;
+		case 'b': burst = atol(optarg); break;
+		case 's': sleep_us = atol(optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc || producers <= 0 || producers > RINGSET_MAX || items <= 0 ||
+		items > UINT32_MAX || burst <= 0 || sleep_us < 0)
+		usage();
+
+	latency = malloc(producers * items * sizeof(latency[0]));
+	printf("mode       items/s   cpu (s)  wakeups/1000   p50       p99       max   (latency in us)\n");
+	measure("poll", consume_poll);
+	measure("wait", consume_wait);
+	return 0;
+}
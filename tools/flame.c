@@ -0,0 +1,334 @@
+// Name: flame.c
+//
+// Turns an instruction trace of the firmware, e.g. from simavr's -t option, into CPU cycles per
+// call stack, written as folded stacks ("main;produce;USART_Transmit 1234" per line) for
+// flamegraph.pl or speedscope:
+//
+//   simavr -t -m atmega328p -f 18432000 main.elf 2>&1 | flame main.elf > main.folded
+//
+// The only thing taken from each line of the trace is the program counter: the first hex number
+// followed by a colon, a byte address unless -w says they are word addresses. Lines without one
+// are skipped. Everything else comes from main.elf: the instruction at each address, decoded
+// from .text, gives the cycles it takes (a taken branch or a skip is seen in the next address)
+// and whether it calls or returns, and the symbol table gives the functions. A call pushes the
+// calling function, ret and reti pop it. An address in the interrupt vector table is an
+// interrupt, which pushes the interrupted function and 4 cycles for the response, and the ISR
+// shows up under the name of its vector, e.g. TIMER0_OVF_vect. So the time of the consumer ISR
+// is split between its own code and the functions it calls, like USART_TransmitString or
+// vfprintf, as is every function's.
+//
+// The cycle counts are those of the ATmega328P, where a call takes 4 cycles and ld/st take 2.
+// The total and the functions with the most cycles of their own are printed on stderr.
+//
+// Usage: flame [-w] <main.elf> [trace|-]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elf.h"
+
+#define NELEMS(x) (sizeof(x)/sizeof((x)[0]))
+
+#define MAX_DEPTH 64
+
+// ATmega328P, 2 words per vector
+static const char *const vectors[] = {
+	"RESET", "INT0_vect", "INT1_vect", "PCINT0_vect", "PCINT1_vect", "PCINT2_vect", "WDT_vect",
+	"TIMER2_COMPA_vect", "TIMER2_COMPB_vect", "TIMER2_OVF_vect", "TIMER1_CAPT_vect",
+	"TIMER1_COMPA_vect", "TIMER1_COMPB_vect", "TIMER1_OVF_vect", "TIMER0_COMPA_vect",
+	"TIMER0_COMPB_vect", "TIMER0_OVF_vect", "SPI_STC_vect", "USART_RX_vect", "USART_UDRE_vect",
+	"USART_TX_vect", "ADC_vect", "EE_READY_vect", "ANALOG_COMP_vect", "TWI_vect", "SPM_READY_vect",
+};
+#define VECTOR_BYTES (NELEMS(vectors) * 4)
+
+enum kind { PLAIN, CALL, RET, BRANCH, SKIP };
+
+struct insn {
+	enum kind kind;
+	unsigned words;
+	unsigned cycles;			// not taken, not skipping
+};
+
+// Cycles per folded stack
+struct entry {
+	char *stack;
+	uint64_t cycles;
+};
+
+static struct entry *table;
+static size_t table_size, table_used;
+
+static struct elf_symbol *functions;
+static long nfunctions;
+static const unsigned char *text;
+static uint64_t text_addr, text_size;
+
+static uint64_t hash(const char *s) {
+	uint64_t h = 14695981039346656037ULL;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+	return h;
+}
+
+static void add(const char *stack, uint64_t cycles) {
+	if (table_used * 2 >= table_size) {
+		struct entry *old = table;
+		size_t old_size = table_size;
+		table_size = table_size ? table_size * 2 : 1024;
+		table = calloc(table_size, sizeof(*table));
+		table_used = 0;
+		for (size_t i = 0; i < old_size; i++)
+			if (old[i].stack)
+				add(old[i].stack, old[i].cycles), free(old[i].stack);
+		free(old);
+	}
+
+	size_t i = hash(stack) & (table_size - 1);
+	while (table[i].stack && strcmp(table[i].stack, stack) != 0)
+		i = (i + 1) & (table_size - 1);
+	if (!table[i].stack) {
+		table[i].stack = strdup(stack);
+		table_used++;
+	}
+	table[i].cycles += cycles;
+}
+
+// Name of the function at addr, the vector for an ISR
+static const char *function_at(uint64_t addr) {
+	long lo = 0, hi = nfunctions - 1;
+	while (lo <= hi) {
+		long mid = (lo + hi) / 2;
+		if (addr < functions[mid].value)
+			hi = mid - 1;
+		else if (addr >= functions[mid].value + functions[mid].size)
+			lo = mid + 1;
+		else {
+			const char *name = functions[mid].name;
+			unsigned n;
+			if (sscanf(name, "__vector_%u", &n) == 1 && n < NELEMS(vectors))
+				return vectors[n];
+			return name;
+		}
+	}
+	return addr < VECTOR_BYTES ? "(vectors)" : "(unknown)";
+}
+
+static uint16_t word_at(uint64_t addr) {
+	if (addr < text_addr || addr + 2 > text_addr + text_size)
+		return 0;
+	const unsigned char *p = text + (addr - text_addr);
+	return p[0] | (p[1] << 8);
+}
+
+static struct insn decode(uint64_t addr) {
+	uint16_t w = word_at(addr);
+
+	if ((w & 0xfe0e) == 0x940e) return (struct insn){ CALL, 2, 4 };		// call
+	if ((w & 0xfe0e) == 0x940c) return (struct insn){ PLAIN, 2, 3 };	// jmp
+	if ((w & 0xf000) == 0xd000) return (struct insn){ CALL, 1, 3 };		// rcall
+	if ((w & 0xf000) == 0xc000) return (struct insn){ PLAIN, 1, 2 };	// rjmp
+	if ((w & 0xffef) == 0x9509) return (struct insn){ CALL, 1, 3 };		// icall, eicall
+	if ((w & 0xffef) == 0x9409) return (struct insn){ PLAIN, 1, 2 };	// ijmp, eijmp
+	if ((w & 0xffef) == 0x9508) return (struct insn){ RET, 1, 4 };		// ret, reti
+	if ((w & 0xfc0f) == 0x9000) return (struct insn){ PLAIN, 2, 2 };	// lds, sts
+	if ((w & 0xf800) == 0xf000) return (struct insn){ BRANCH, 1, 1 };	// brbs, brbc
+	if ((w & 0xfc00) == 0x1000 ||											// cpse
+		(w & 0xfc08) == 0xfc00 ||											// sbrc, sbrs
+		(w & 0xfd00) == 0x9900)												// sbic, sbis
+		return (struct insn){ SKIP, 1, 1 };
+	if ((w & 0xfd00) == 0x9800) return (struct insn){ PLAIN, 1, 2 };	// cbi, sbi
+	if ((w & 0xfe00) == 0x9600) return (struct insn){ PLAIN, 1, 2 };	// adiw, sbiw
+	if (w == 0x95c8 || w == 0x95d8 ||										// lpm, elpm
+		(w & 0xfe0c) == 0x9004)												// lpm, elpm Rd, Z(+)
+		return (struct insn){ PLAIN, 1, 3 };
+	if ((w & 0xfc00) == 0x9c00 || (w & 0xfe00) == 0x0200)					// mul, muls, mulsu,
+		return (struct insn){ PLAIN, 1, 2 };								// fmul*
+	if ((w & 0xfc00) == 0x9000 ||											// ld, st, push, pop
+		(w & 0xd000) == 0x8000)												// ldd, std
+		return (struct insn){ PLAIN, 1, 2 };
+	return (struct insn){ PLAIN, 1, 1 };
+}
+
+// Where a call goes, the address itself for an indirect one
+static uint64_t call_target(uint64_t addr) {
+	uint16_t w = word_at(addr);
+	if ((w & 0xf000) == 0xd000)												// rcall
+		return addr + 2 + 2 * (int64_t)(((w & 0xfff) ^ 0x800) - 0x800);
+	if ((w & 0xfe0e) == 0x940e)												// call
+		return 2 * ((((uint64_t)(w & 0x1f0) >> 3 | (w & 1)) << 16 | word_at(addr + 2)));
+	return addr;
+}
+
+// The trace's program counter, -1 if the line has none
+static int64_t parse_pc(const char *line) {
+	for (const char *p = line; *p; p++) {
+		const char *start = p;
+		if (p[0] == '0' && p[1] == 'x')
+			p += 2;
+		const char *digits = p;
+		while ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F'))
+			p++;
+		if (p > digits && *p == ':' && (start == line || start[-1] == ' ' || start[-1] == '\t'))
+			return strtoll(digits, NULL, 16);
+		if (p == start)
+			continue;
+		p--;
+	}
+	return -1;
+}
+
+static int by_cycles(const void *a, const void *b) {
+	const struct entry *ea = a, *eb = b;
+	return ea->cycles < eb->cycles ? 1 : ea->cycles > eb->cycles ? -1 : 0;
+}
+
+// Cycles per leaf function, the most first
+static void print_summary(uint64_t total) {
+	struct entry *self = calloc(table_used + 1, sizeof(*self));
+	size_t n = 0;
+
+	for (size_t i = 0; i < table_size; i++) {
+		if (!table[i].stack)
+			continue;
+		const char *leaf = strrchr(table[i].stack, ';');
+		leaf = leaf ? leaf + 1 : table[i].stack;
+		size_t j;
+		for (j = 0; j < n && strcmp(self[j].stack, leaf) != 0; j++)
+			;
+		if (j == n)
+			self[n++].stack = (char *)leaf;
+		self[j].cycles += table[i].cycles;
+	}
+
+	qsort(self, n, sizeof(*self), by_cycles);
+	fprintf(stderr, "%llu cycles\n\n   self%%       cycles  function\n", (unsigned long long)total);
+	for (size_t j = 0; j < n && j < 20; j++)
+		fprintf(stderr, "  %6.2f %12llu  %s\n", total ? 100.0 * self[j].cycles / total : 0.0,
+				(unsigned long long)self[j].cycles, self[j].stack);
+	free(self);
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: flame [-w] <main.elf> [trace|-]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	int words = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w")) != -1) {
+		switch (opt) {
+		case 'w': words = 1; break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 && optind != argc - 2)
+		usage();
+
+	struct elf elf;
+	struct elf_section section;
+	if (elf_open(&elf, argv[optind]) < 0 || (nfunctions = elf_functions(&elf, &functions)) < 0)
+		return 1;
+	if (elf_find_section(&elf, ".text", &section) < 0 || !section.data) {
+		fprintf(stderr, "%s: no .text section\n", argv[optind]);
+		return 1;
+	}
+	text = section.data;
+	text_addr = section.addr;
+	text_size = section.size;
+
+	FILE *in = stdin;
+	if (optind + 1 < argc && strcmp(argv[optind + 1], "-") != 0 &&
+		!(in = fopen(argv[optind + 1], "r"))) {
+		perror(argv[optind + 1]);
+		return 1;
+	}
+
+	const char *stack[MAX_DEPTH];		// the callers, outermost first
+	int depth = 0;
+	char key[4096] = "";
+	uint64_t key_cycles = 0, total = 0;
+	int64_t prev = -1;
+	struct insn prev_insn = { PLAIN, 1, 1 };
+	char line[512];
+
+	while (fgets(line, sizeof(line), in)) {
+		int64_t pc = parse_pc(line);
+		if (pc < 0)
+			continue;
+		if (words)
+			pc *= 2;
+
+		const char *leaf = function_at(pc);
+		uint64_t cycles = 0;
+
+		if (prev >= 0) {
+			const char *where = function_at(prev);
+			uint64_t next = prev + 2 * prev_insn.words;
+
+			if (prev_insn.kind == CALL) {
+				if (depth < MAX_DEPTH)
+					stack[depth++] = where;
+				where = function_at(call_target(prev));
+			} else if (prev_insn.kind == RET && depth > 0) {
+				where = stack[--depth];
+			}
+
+			// An interrupt, between the previous instruction and this one, in the function
+			// execution went on in
+			if (pc >= 4 && pc < (int64_t)VECTOR_BYTES && prev >= (int64_t)VECTOR_BYTES) {
+				if (depth < MAX_DEPTH)
+					stack[depth++] = where;
+				cycles += 4;
+			}
+
+			// The previous instruction's cost, now that we know where it went
+			if (prev_insn.kind == BRANCH && (uint64_t)pc != next)
+				prev_insn.cycles++;
+			else if (prev_insn.kind == SKIP && (uint64_t)pc != next)
+				prev_insn.cycles += decode(next).words;
+		}
+
+		// Cycles go to the stack the instruction was in
+		if (prev >= 0)
+			key_cycles += prev_insn.cycles;
+
+		char now[sizeof(key)];
+		size_t len = 0;
+		now[0] = '\0';
+		for (int i = 0; i < depth && len < sizeof(now) - 256; i++)
+			len += snprintf(now + len, sizeof(now) - len, "%s;", stack[i]);
+		snprintf(now + len, sizeof(now) - len, "%s", leaf);
+
+		if (strcmp(now, key) != 0) {
+			if (key_cycles)
+				add(key, key_cycles);
+			total += key_cycles;
+			key_cycles = 0;
+			strcpy(key, now);
+		}
+		key_cycles += cycles;
+
+		prev = pc;
+		prev_insn = decode(pc);
+	}
+	key_cycles += prev_insn.cycles;
+	if (prev >= 0 && key_cycles)
+		add(key, key_cycles);
+	total += key_cycles;
+
+	for (size_t i = 0; i < table_size; i++)
+		if (table[i].stack)
+			printf("%s %llu\n", table[i].stack, (unsigned long long)table[i].cycles);
+	print_summary(total);
+
+	if (in != stdin)
+		fclose(in);
+	free(functions);
+	elf_close(&elf);
+	return 0;
+}
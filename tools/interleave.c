@@ -0,0 +1,723 @@
+// Name: interleave.c
+//
+// Exhaustive interleaving explorer for the lock-free queue in ring.h.
+//
+// The correctness argument for the queue (only the producer writes tail, only the consumer
+// writes head, the data is written before tail is advanced and read before head is advanced)
+// lives in the comments of ring.h. The variants ring.h-avr and ring.h-host are the code ring.h
+// compiles to on the AVR and on a host, volatile is the queue main.c had before ring.h. Any optimisation of the queue, like caching an index instead of
+// re-reading the volatile, or reordering the index updates, has to preserve it. This tool
+// checks that mechanically.
+//
+// enqueue() and dequeue() are modelled as small programs, one shared memory access per step.
+// The explorer then tries every possible schedule of those steps, and reports a counterexample
+// if any schedule makes the consumer see an item out of order, a torn or stale item, or lose an
+// item. The memory models are:
+//
+//   avr      main() is interrupted between any two steps by the ISR, which runs to completion
+//            (it is never interrupted by main()), and memory is sequentially consistent
+//   sc       producer and consumer are threads on a host, sequentially consistent
+//   tso      threads with FIFO store buffers, as on x86
+//   relaxed  threads on a weakly ordered host (e.g. ARM): a plain load may return any value
+//            of a location not older than what the thread has already observed, and only an
+//            acquire load of a value written by a release store makes the writer's earlier
+//            stores visible. Load buffering is not modelled.
+//
+// Each variant of the queue code is checked under each model and compared with the expected
+// outcome, so adding a variant for a proposed optimisation and its expected results turns the
+// argument into a test. The default queue is 3 slots long (2 usable) and 4 items are passed
+// through it, enough to wrap around. The torn index variant uses 4 slots, so that an index has
+// two halves to tear.
+//
+// Usage: interleave [-v variant] [-m model] [-l length] [-n items] [-t]
+//   Without -v/-m all combinations are checked against the expected table. -t prints the
+//   counterexample schedule for failures.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NELEMS(x) (sizeof(x)/sizeof((x)[0]))
+
+// Shared memory locations. The _HI halves are only used by the torn-index variant, which
+// stores an index in two halves, like a 16-bit index on an 8-bit AVR.
+enum { HEAD, HEAD_HI, TAIL, TAIL_HI, SLOTS };
+
+#define MAX_LENGTH 4
+#define FIELDS 3							// r, g, b
+#define LOCATIONS (SLOTS + MAX_LENGTH * FIELDS)
+#define HISTORY 8							// stores per location kept by the relaxed model
+#define STORE_BUFFER 4						// per thread, tso model
+#define REGISTERS 8
+
+enum model { AVR, SC, TSO, RELAXED };
+static const char *model_names[] = { "avr", "sc", "tso", "relaxed" };
+
+enum op {
+	LD,			// reg[a] = mem[b]
+	LDACQ,		// acquire load
+	ST,			// mem[a] = reg[b]
+	STREL,		// release store
+	LDLO,		// reg[a] = mem[b], low half of a split index
+	LDHI,		// reg[a] |= mem[b + 1] << 1, high half of a split index
+	STLO,		// mem[a] = reg[b] & 1
+	STHI,		// mem[a + 1] = reg[b] >> 1
+	LDS,		// reg[a] = slot field c of index reg[b]
+	STV,		// slot field b of index reg[a] = value of item reg[c]
+	NEXT,		// reg[a] = (reg[b] + 1) % length
+	MOV,		// reg[a] = reg[b]
+	INC,		// reg[a]++
+	BEQ,		// if (reg[a] == reg[b]) goto c
+	BDONE,		// if (reg[a] >= items) goto c
+	JMP,		// goto c
+	CHECK,		// consumer: reg[3..5] must hold item reg[0], then reg[0]++
+	RET,		// consumer: end of one ISR invocation / loop iteration
+	HALT,		// producer: done
+};
+
+struct insn {
+	uint8_t op, a, b, c;
+	const char *text;						// the C it models
+};
+
+#define I(op, a, b, c, text) { op, a, b, c, text }
+
+// Producer registers: 0 item, 1 tail, 2 next tail, 3 head
+// Consumer registers: 0 expected item, 1 head, 2 tail, 3..5 r/g/b, 6 next head
+
+// The queue main.c had before ring.h: indices are volatile and re-read on every use
+static const struct insn producer_volatile[] = {
+	I(BDONE, 0, 0, 14, "for (;;)"),
+	I(LD, 3, HEAD, 0, "full(): head"),
+	I(LD, 1, TAIL, 0, "full(): tail"),
+	I(NEXT, 2, 1, 0, "full(): (tail + 1) % N"),
+	I(BEQ, 3, 2, 1, "while (full())"),
+	I(LD, 1, TAIL, 0, "enqueue(): tail"),
+	I(STV, 1, 0, 0, "queue[tail].r = r"),
+	I(STV, 1, 1, 0, "queue[tail].g = g"),
+	I(STV, 1, 2, 0, "queue[tail].b = b"),
+	I(LD, 1, TAIL, 0, "enqueue(): tail"),
+	I(NEXT, 2, 1, 0, "(tail + 1) % N"),
+	I(ST, TAIL, 2, 0, "tail = ..."),
+	I(INC, 0, 0, 0, "next colour"),
+	I(JMP, 0, 0, 0, ""),
+	I(HALT, 0, 0, 0, ""),
+};
+
+static const struct insn consumer_volatile[] = {
+	I(LD, 1, HEAD, 0, "empty(): head"),
+	I(LD, 2, TAIL, 0, "empty(): tail"),
+	I(BEQ, 1, 2, 11, "if (!empty())"),
+	I(LD, 1, HEAD, 0, "dequeue(): head"),
+	I(LDS, 3, 1, 0, "r = queue[head].r"),
+	I(LDS, 4, 1, 1, "g = queue[head].g"),
+	I(LDS, 5, 1, 2, "b = queue[head].b"),
+	I(LD, 1, HEAD, 0, "dequeue(): head"),
+	I(NEXT, 6, 1, 0, "(head + 1) % N"),
+	I(ST, HEAD, 6, 0, "head = ..."),
+	I(CHECK, 0, 0, 0, "use the item"),
+	I(RET, 0, 0, 0, "reti"),
+};
+
+// ring.h on the AVR: each side keeps its own index in a register instead of re-reading the
+// volatile, and only reads the other side's index once per operation
+static const struct insn producer_cached[] = {
+	I(BDONE, 0, 0, 11, "for (;;)"),
+	I(LD, 3, HEAD, 0, "full(): head"),
+	I(NEXT, 2, 1, 0, "full(): (tail + 1) % N"),
+	I(BEQ, 3, 2, 1, "while (full())"),
+	I(STV, 1, 0, 0, "queue[tail].r = r"),
+	I(STV, 1, 1, 0, "queue[tail].g = g"),
+	I(STV, 1, 2, 0, "queue[tail].b = b"),
+	I(ST, TAIL, 2, 0, "tail = next"),
+	I(MOV, 1, 2, 0, "cached tail = next"),
+	I(INC, 0, 0, 0, "next colour"),
+	I(JMP, 0, 0, 0, ""),
+	I(HALT, 0, 0, 0, ""),
+};
+
+static const struct insn consumer_cached[] = {
+	I(LD, 2, TAIL, 0, "empty(): tail"),
+	I(BEQ, 1, 2, 8, "if (!empty())"),
+	I(LDS, 3, 1, 0, "r = queue[head].r"),
+	I(LDS, 4, 1, 1, "g = queue[head].g"),
+	I(LDS, 5, 1, 2, "b = queue[head].b"),
+	I(NEXT, 1, 1, 0, "cached head = (head + 1) % N"),
+	I(ST, HEAD, 1, 0, "head = cached head"),
+	I(CHECK, 0, 0, 0, "use the item"),
+	I(RET, 0, 0, 0, "reti"),
+};
+
+// ring.h on a host: as above, with the index loads acquiring and the index stores releasing
+// in place of volatile
+static const struct insn producer_release[] = {
+	I(BDONE, 0, 0, 11, "for (;;)"),
+	I(LDACQ, 3, HEAD, 0, "full(): acquire head"),
+	I(NEXT, 2, 1, 0, "full(): (tail + 1) % N"),
+	I(BEQ, 3, 2, 1, "while (full())"),
+	I(STV, 1, 0, 0, "queue[tail].r = r"),
+	I(STV, 1, 1, 0, "queue[tail].g = g"),
+	I(STV, 1, 2, 0, "queue[tail].b = b"),
+	I(STREL, TAIL, 2, 0, "release tail = next"),
+	I(MOV, 1, 2, 0, "cached tail = next"),
+	I(INC, 0, 0, 0, "next colour"),
+	I(JMP, 0, 0, 0, ""),
+	I(HALT, 0, 0, 0, ""),
+};
+
+static const struct insn consumer_acquire[] = {
+	I(LDACQ, 2, TAIL, 0, "empty(): acquire tail"),
+	I(BEQ, 1, 2, 8, "if (!empty())"),
+	I(LDS, 3, 1, 0, "r = queue[head].r"),
+	I(LDS, 4, 1, 1, "g = queue[head].g"),
+	I(LDS, 5, 1, 2, "b = queue[head].b"),
+	I(NEXT, 1, 1, 0, "cached head = (head + 1) % N"),
+	I(STREL, HEAD, 1, 0, "release head = cached head"),
+	I(CHECK, 0, 0, 0, "use the item"),
+	I(RET, 0, 0, 0, "reti"),
+};
+
+// Advances tail before the item is written
+static const struct insn producer_publish_early[] = {
+	I(BDONE, 0, 0, 11, "for (;;)"),
+	I(LD, 3, HEAD, 0, "full(): head"),
+	I(NEXT, 2, 1, 0, "full(): (tail + 1) % N"),
+	I(BEQ, 3, 2, 1, "while (full())"),
+	I(ST, TAIL, 2, 0, "tail = next"),
+	I(STV, 1, 0, 0, "queue[old tail].r = r"),
+	I(STV, 1, 1, 0, "queue[old tail].g = g"),
+	I(STV, 1, 2, 0, "queue[old tail].b = b"),
+	I(MOV, 1, 2, 0, "cached tail = next"),
+	I(INC, 0, 0, 0, "next colour"),
+	I(JMP, 0, 0, 0, ""),
+	I(HALT, 0, 0, 0, ""),
+};
+
+// Advances head before the item is copied out
+static const struct insn consumer_free_early[] = {
+	I(LD, 2, TAIL, 0, "empty(): tail"),
+	I(BEQ, 1, 2, 9, "if (!empty())"),
+	I(NEXT, 6, 1, 0, "next = (head + 1) % N"),
+	I(ST, HEAD, 6, 0, "head = next"),
+	I(LDS, 3, 1, 0, "r = queue[old head].r"),
+	I(LDS, 4, 1, 1, "g = queue[old head].g"),
+	I(LDS, 5, 1, 2, "b = queue[old head].b"),
+	I(MOV, 1, 6, 0, "cached head = next"),
+	I(CHECK, 0, 0, 0, "use the item"),
+	I(RET, 0, 0, 0, "reti"),
+};
+
+// tail is wider than a single atomic store, and written one half at a time
+static const struct insn producer_torn[] = {
+	I(BDONE, 0, 0, 12, "for (;;)"),
+	I(LD, 3, HEAD, 0, "full(): head"),
+	I(NEXT, 2, 1, 0, "full(): (tail + 1) % N"),
+	I(BEQ, 3, 2, 1, "while (full())"),
+	I(STV, 1, 0, 0, "queue[tail].r = r"),
+	I(STV, 1, 1, 0, "queue[tail].g = g"),
+	I(STV, 1, 2, 0, "queue[tail].b = b"),
+	I(STLO, TAIL, 2, 0, "tail.lo = next"),
+	I(STHI, TAIL, 2, 0, "tail.hi = next"),
+	I(MOV, 1, 2, 0, "cached tail = next"),
+	I(INC, 0, 0, 0, "next colour"),
+	I(JMP, 0, 0, 0, ""),
+	I(HALT, 0, 0, 0, ""),
+};
+
+static const struct insn consumer_torn[] = {
+	I(LDLO, 2, TAIL, 0, "empty(): tail.lo"),
+	I(LDHI, 2, TAIL, 0, "empty(): tail.hi"),
+	I(BEQ, 1, 2, 9, "if (!empty())"),
+	I(LDS, 3, 1, 0, "r = queue[head].r"),
+	I(LDS, 4, 1, 1, "g = queue[head].g"),
+	I(LDS, 5, 1, 2, "b = queue[head].b"),
+	I(NEXT, 1, 1, 0, "cached head = (head + 1) % N"),
+	I(ST, HEAD, 1, 0, "head = cached head"),
+	I(CHECK, 0, 0, 0, "use the item"),
+	I(RET, 0, 0, 0, "reti"),
+};
+
+#define PROGRAM(p) p, NELEMS(p)
+
+// The expected outcome per model, in the order of enum model: 1 = correct, 0 = broken
+static const struct variant {
+	const char *name;
+	const struct insn *producer;
+	uint8_t producer_len;
+	const struct insn *consumer;
+	uint8_t consumer_len;
+	uint8_t expected[4];
+	uint8_t length;							// queue length needed, 0 for the default
+	const char *note;
+} variants[] = {
+	{ "volatile", PROGRAM(producer_volatile), PROGRAM(consumer_volatile), { 1, 1, 1, 0 }, 0,
+	  "volatile is enough on the AVR and on x86, not on weakly ordered hosts" },
+	{ "ring.h-avr", PROGRAM(producer_cached), PROGRAM(consumer_cached), { 1, 1, 1, 0 }, 0,
+	  "owning side may cache its index instead of re-reading the volatile" },
+	{ "ring.h-host", PROGRAM(producer_release), PROGRAM(consumer_acquire), { 1, 1, 1, 1 }, 0,
+	  "what a host needs: acquire the other index, release your own" },
+	{ "publish-early", PROGRAM(producer_publish_early), PROGRAM(consumer_cached), { 0, 0, 0, 0 }, 0,
+	  "tail must not move before the item is written" },
+	{ "free-early", PROGRAM(producer_cached), PROGRAM(consumer_free_early), { 1, 1, 1, 0 }, 0,
+	  "safe: the slot kept empty to tell full from empty keeps the producer off the freed slot" },
+	{ "torn-index", PROGRAM(producer_torn), PROGRAM(consumer_torn), { 0, 0, 0, 0 }, 4,
+	  "indices must be written with a single store, hence uint8_t" },
+};
+
+// Complete machine state. It is hashed as raw bytes, so it is always zeroed before use.
+struct state {
+	uint8_t pc[2];							// 0 = producer, 1 = consumer
+	uint8_t reg[2][REGISTERS];
+	uint8_t isr_running;					// avr: consumer invocation in progress
+	uint8_t consumed;
+
+	uint8_t mem[LOCATIONS];					// avr, sc, tso
+
+	uint8_t sb_len[2];						// tso
+	uint8_t sb_loc[2][STORE_BUFFER];
+	uint8_t sb_val[2][STORE_BUFFER];
+
+	uint8_t hist_len[LOCATIONS];			// relaxed
+	uint8_t hist_val[LOCATIONS][HISTORY];
+	uint8_t hist_rel[LOCATIONS][HISTORY];	// 1 if written by a release store
+	uint8_t hist_view[LOCATIONS][HISTORY][LOCATIONS];	// writer's view at a release store
+	uint8_t view[2][LOCATIONS];				// newest store each thread has observed
+};
+
+static struct {
+	const struct variant *v;
+	enum model model;
+	uint8_t length;
+	uint8_t items;
+	int show_trace;
+
+	// Visited states, open addressing on 64-bit hashes
+	uint64_t *seen;
+	uint64_t seen_mask;
+	uint64_t states;
+
+	// Schedule leading to the current state, for counterexamples
+	struct step {
+		uint8_t thread, pc;
+		uint8_t loaded;						// 1 if the step was a load
+		uint8_t value;						// the value it returned
+		uint8_t stale;						// 1 if a newer value had already been stored
+	} path[4096];
+	unsigned depth;
+
+	const char *failure;
+	struct step failure_path[4096];
+	unsigned failure_depth;
+} ex;
+
+static uint8_t item_value(uint8_t item, uint8_t field) {
+	return item * FIELDS + field + 1;		// never 0, the initial memory contents
+}
+
+static uint8_t slot_location(uint8_t index, uint8_t field) {
+	return SLOTS + (index % ex.length) * FIELDS + field;
+}
+
+static uint64_t hash_state(const struct state *s) {
+	const uint8_t *p = (const uint8_t *)s;
+	uint64_t h = 1469598103934665603ULL;
+
+	// Only the relaxed model uses the (large) store histories
+	size_t size = ex.model == RELAXED ? sizeof(*s) : offsetof(struct state, hist_len);
+	for (size_t i = 0; i < size; i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h ? h : 1;
+}
+
+// Returns 1 if the state was already explored
+static int visit(const struct state *s) {
+	uint64_t h = hash_state(s);
+	uint64_t i = h & ex.seen_mask;
+	while (ex.seen[i]) {
+		if (ex.seen[i] == h)
+			return 1;
+		i = (i + 1) & ex.seen_mask;
+	}
+	if (++ex.states > ex.seen_mask / 2) {
+		fprintf(stderr, "interleave: state table full, use fewer items\n");
+		exit(2);
+	}
+	ex.seen[i] = h;
+	return 0;
+}
+
+static void fail(const char *why) {
+	if (ex.failure)
+		return;
+	ex.failure = why;
+	ex.failure_depth = ex.depth;
+	memcpy(ex.failure_path, ex.path, ex.depth * sizeof(ex.path[0]));
+}
+
+// Memory access for the current model. A relaxed load may have several possible results, the
+// caller passes which one (choice) and gets the number of choices back.
+
+static int load_choices(const struct state *s, int t, uint8_t loc) {
+	if (ex.model != RELAXED)
+		return 1;
+	return s->hist_len[loc] - s->view[t][loc];
+}
+
+static uint8_t load(struct state *s, int t, uint8_t loc, int choice, int acquire) {
+	if (ex.model == TSO) {
+		// Forward from our own store buffer, newest entry first
+		for (int i = s->sb_len[t] - 1; i >= 0; i--)
+			if (s->sb_loc[t][i] == loc)
+				return s->sb_val[t][i];
+		return s->mem[loc];
+	}
+	if (ex.model != RELAXED)
+		return s->mem[loc];
+
+	uint8_t idx = s->view[t][loc] + choice;
+	s->view[t][loc] = idx;
+	if (acquire && s->hist_rel[loc][idx]) {
+		for (int l = 0; l < LOCATIONS; l++)
+			if (s->hist_view[loc][idx][l] > s->view[t][l])
+				s->view[t][l] = s->hist_view[loc][idx][l];
+	}
+	return s->hist_val[loc][idx];
+}
+
+static void store(struct state *s, int t, uint8_t loc, uint8_t value, int release) {
+	if (ex.model == TSO) {
+		s->sb_loc[t][s->sb_len[t]] = loc;
+		s->sb_val[t][s->sb_len[t]++] = value;
+		return;
+	}
+	if (ex.model != RELAXED) {
+		s->mem[loc] = value;
+		return;
+	}
+
+	uint8_t idx = s->hist_len[loc];
+	if (idx == HISTORY) {
+		fprintf(stderr, "interleave: history overflow, use fewer items\n");
+		exit(2);
+	}
+	s->hist_len[loc] = idx + 1;
+	s->hist_val[loc][idx] = value;
+	s->view[t][loc] = idx;
+	if (release) {
+		s->hist_rel[loc][idx] = 1;
+		memcpy(s->hist_view[loc][idx], s->view[t], LOCATIONS);
+	}
+}
+
+static const struct insn *program(int t, uint8_t *len) {
+	*len = t ? ex.v->consumer_len : ex.v->producer_len;
+	return t ? ex.v->consumer : ex.v->producer;
+}
+
+static int halted(const struct state *s, int t) {
+	if (t)
+		return s->consumed >= ex.items;
+	uint8_t len;
+	const struct insn *p = program(0, &len);
+	return p[s->pc[0]].op == HALT;
+}
+
+// Number of possible outcomes of the next instruction of thread t
+static int choices(const struct state *s, int t) {
+	uint8_t len;
+	const struct insn *in = &program(t, &len)[s->pc[t]];
+	switch (in->op) {
+	case LD: case LDACQ: case LDLO:
+		return load_choices(s, t, in->b);
+	case LDHI:
+		return load_choices(s, t, in->b + 1);
+	case LDS:
+		return load_choices(s, t, slot_location(s->reg[t][in->b], in->c));
+	default:
+		return 1;
+	}
+}
+
+static int is_load(uint8_t op) {
+	return op == LD || op == LDACQ || op == LDLO || op == LDHI || op == LDS;
+}
+
+// Records the value a load step returned, for counterexamples
+static void record_load(const struct state *s, int t, int choice, int n) {
+	struct step *st = &ex.path[ex.depth - 1];
+	uint8_t len;
+	const struct insn *in = &program(t, &len)[st->pc];
+	if (!is_load(in->op))
+		return;
+	st->loaded = 1;
+	st->value = s->reg[t][in->a];
+	st->stale = choice < n - 1;
+}
+
+// Executes one instruction of thread t. Returns 0 if the thread cannot make progress.
+static int step(struct state *s, int t, int choice) {
+	uint8_t len;
+	const struct insn *in = &program(t, &len)[s->pc[t]];
+	uint8_t *r = s->reg[t];
+	uint8_t next = s->pc[t] + 1;
+
+	// A full store buffer stalls the thread until a store drains
+	if (ex.model == TSO && s->sb_len[t] == STORE_BUFFER)
+		return 0;
+
+	switch (in->op) {
+	case LD: r[in->a] = load(s, t, in->b, choice, 0); break;
+	case LDACQ: r[in->a] = load(s, t, in->b, choice, 1); break;
+	case ST: store(s, t, in->a, r[in->b], 0); break;
+	case STREL:
+		// On tso a release store is an ordinary store, the buffer is already FIFO
+		store(s, t, in->a, r[in->b], 1);
+		break;
+	case LDLO: r[in->a] = load(s, t, in->b, choice, 0); break;
+	case LDHI: r[in->a] |= load(s, t, in->b + 1, choice, 0) << 1; break;
+	case STLO: store(s, t, in->a, r[in->b] & 1, 0); break;
+	case STHI: store(s, t, in->a + 1, r[in->b] >> 1, 0); break;
+	case LDS: r[in->a] = load(s, t, slot_location(r[in->b], in->c), choice, 0); break;
+	case STV: store(s, t, slot_location(r[in->a], in->b), item_value(r[in->c], in->b), 0); break;
+	case NEXT: r[in->a] = (r[in->b] + 1) % ex.length; break;
+	case MOV: r[in->a] = r[in->b]; break;
+	case INC: r[in->a]++; break;
+	case BEQ: if (r[in->a] == r[in->b]) next = in->c; break;
+	case BDONE: if (r[in->a] >= ex.items) next = in->c; break;
+	case JMP: next = in->c; break;
+	case CHECK:
+		for (int f = 0; f < FIELDS; f++)
+			if (r[3 + f] != item_value(r[0], f)) {
+				fail(r[3 + f] == 0 ? "consumer read a slot before it was written"
+					 : "consumer read the wrong item");
+				return 0;
+			}
+		r[0]++;
+		s->consumed++;
+		break;
+	case RET:
+		next = 0;
+		s->isr_running = 0;
+		break;
+	case HALT:
+		return 0;
+	}
+	s->pc[t] = next;
+	return 1;
+}
+
+// avr: the ISR runs to completion. Relaxed loads do not apply, memory is sequentially
+// consistent, so there is exactly one outcome.
+static int run_isr(struct state *s) {
+	s->isr_running = 1;
+	while (s->isr_running) {
+		if (ex.depth < NELEMS(ex.path))
+			ex.path[ex.depth++] = (struct step){ 1, s->pc[1], 0, 0, 0 };
+		if (!step(s, 1, 0))
+			return 0;
+		record_load(s, 1, 0, 1);
+	}
+	return 1;
+}
+
+// Once the producer is done, the consumer has to be able to drain everything. Stores
+// eventually become visible, so this runs the consumer alone on the newest values.
+static void check_drain(struct state s) {
+	if (ex.model == TSO)
+		for (int t = 0; t < 2; t++) {
+			for (int i = 0; i < s.sb_len[t]; i++)
+				s.mem[s.sb_loc[t][i]] = s.sb_val[t][i];
+			s.sb_len[t] = 0;
+		}
+	if (ex.model == RELAXED)
+		for (int l = 0; l < LOCATIONS; l++)
+			if (s.hist_len[l])
+				s.view[1][l] = s.hist_len[l] - 1;
+
+	for (int n = 0; n < 10000 && s.consumed < ex.items; n++) {
+		int c = ex.model == RELAXED ? choices(&s, 1) - 1 : 0;	// newest value
+		if (!step(&s, 1, c))
+			return;
+	}
+	if (s.consumed < ex.items)
+		fail("an item was lost, the consumer cannot drain the queue");
+}
+
+static void explore(const struct state *s) {
+	if (ex.failure || visit(s))
+		return;
+
+	if (halted(s, 0)) {
+		check_drain(*s);
+		if (ex.failure)
+			return;
+	}
+
+	// The producer takes a step
+	if (!halted(s, 0)) {
+		int n = choices(s, 0);
+		for (int c = 0; c < n && !ex.failure; c++) {
+			struct state next = *s;
+			ex.path[ex.depth++] = (struct step){ 0, s->pc[0], 0, 0, 0 };
+			if (step(&next, 0, c)) {
+				record_load(&next, 0, c, n);
+				explore(&next);
+			}
+			ex.depth--;
+		}
+	}
+
+	if (halted(s, 1))
+		return;
+
+	if (ex.model == AVR) {
+		// The ISR fires between these two producer steps
+		unsigned depth = ex.depth;
+		struct state next = *s;
+		if (run_isr(&next))
+			explore(&next);
+		ex.depth = depth;
+		return;
+	}
+
+	// The consumer takes a step
+	int n = choices(s, 1);
+	for (int c = 0; c < n && !ex.failure; c++) {
+		struct state next = *s;
+		ex.path[ex.depth++] = (struct step){ 1, s->pc[1], 0, 0, 0 };
+		if (step(&next, 1, c)) {
+			record_load(&next, 1, c, n);
+			explore(&next);
+		}
+		ex.depth--;
+	}
+
+	// A buffered store becomes visible
+	if (ex.model == TSO)
+		for (int t = 0; t < 2 && !ex.failure; t++) {
+			if (!s->sb_len[t])
+				continue;
+			struct state next = *s;
+			next.mem[next.sb_loc[t][0]] = next.sb_val[t][0];
+			next.sb_len[t]--;
+			memmove(next.sb_loc[t], next.sb_loc[t] + 1, next.sb_len[t]);
+			memmove(next.sb_val[t], next.sb_val[t] + 1, next.sb_len[t]);
+			ex.path[ex.depth++] = (struct step){ 2 + t, 0, 0, 0, 0 };
+			explore(&next);
+			ex.depth--;
+		}
+}
+
+static void print_trace(void) {
+	for (unsigned i = 0; i < ex.failure_depth; i++) {
+		const struct step *st = &ex.failure_path[i];
+		if (st->thread >= 2) {
+			printf("    %-9s store buffer drains one store\n",
+				   st->thread == 2 ? "producer" : "consumer");
+			continue;
+		}
+		uint8_t len;
+		const struct insn *in = &program(st->thread, &len)[st->pc];
+		printf("    %-9s %2u: %s", st->thread ? (ex.model == AVR ? "ISR" : "consumer") : "main()",
+			   st->pc, in->text);
+		if (st->loaded)
+			printf("  -> %u%s", st->value, st->stale ? " (stale)" : "");
+		printf("\n");
+	}
+}
+
+// Returns 1 if every schedule is correct
+static int check(const struct variant *v, enum model m, uint8_t length) {
+	ex.v = v;
+	ex.length = v->length ? v->length : length;
+	ex.model = m;
+	ex.failure = NULL;
+	ex.depth = 0;
+	ex.states = 0;
+	memset(ex.seen, 0, (ex.seen_mask + 1) * sizeof(*ex.seen));
+
+	struct state *s = calloc(1, sizeof(*s));
+	if (m == RELAXED)
+		for (int l = 0; l < LOCATIONS; l++)
+			s->hist_len[l] = 1;				// the initial zero
+	explore(s);
+	free(s);
+	return ex.failure == NULL;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: interleave [-v variant] [-m model] [-l length] [-n items] [-t]\n");
+	fprintf(stderr, "variants:");
+	for (size_t i = 0; i < NELEMS(variants); i++)
+		fprintf(stderr, " %s", variants[i].name);
+	fprintf(stderr, "\nmodels: avr sc tso relaxed\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	const char *only_variant = NULL;
+	int only_model = -1;
+	int length = 3;
+	ex.items = 4;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "v:m:l:n:t")) != -1) {
+		switch (opt) {
+		case 'v': only_variant = optarg; break;
+		case 'm':
+			for (int m = 0; m < 4; m++)
+				if (strcmp(optarg, model_names[m]) == 0)
+					only_model = m;
+			if (only_model < 0)
+				usage();
+			break;
+		case 'l': length = atoi(optarg); break;
+		case 'n': ex.items = atoi(optarg); break;
+		case 't': ex.show_trace = 1; break;
+		default: usage();
+		}
+	}
+	if (length < 2 || length > MAX_LENGTH || ex.items < 1 || ex.items > 80)
+		usage();
+
+	ex.seen_mask = (1 << 24) - 1;
+	ex.seen = calloc(ex.seen_mask + 1, sizeof(*ex.seen));
+
+	int mismatches = 0, ran = 0;
+	printf("%-16s %-8s %-8s %-8s %10s\n", "variant", "model", "result", "expected", "states");
+	for (size_t i = 0; i < NELEMS(variants); i++) {
+		const struct variant *v = &variants[i];
+		if (only_variant && strcmp(only_variant, v->name) != 0)
+			continue;
+		for (int m = 0; m < 4; m++) {
+			if (only_model >= 0 && m != only_model)
+				continue;
+			ran++;
+			int ok = check(v, m, length);
+			int match = ok == v->expected[m];
+			mismatches += !match;
+			printf("%-16s %-8s %-8s %-8s %10llu%s\n", v->name, model_names[m],
+				   ok ? "correct" : "BROKEN", v->expected[m] ? "correct" : "broken",
+				   (unsigned long long)ex.states, match ? "" : "  <-- unexpected");
+			if (!ok) {
+				printf("    %s\n", ex.failure);
+				if (ex.show_trace)
+					print_trace();
+			}
+		}
+	}
+	if (!ran)
+		usage();
+
+	if (!only_variant && only_model < 0) {
+		printf("\n");
+		for (size_t i = 0; i < NELEMS(variants); i++)
+			printf("%-16s %s\n", variants[i].name, variants[i].note);
+	}
+
+	free(ex.seen);
+	return mismatches ? 1 : 0;
+}
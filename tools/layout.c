@@ -0,0 +1,161 @@
+// Name: layout.c
+//
+// Host benchmark of the two storage layouts of ring.h: RING_DEFINE() with an array of RGB
+// structs, and RING_DEFINE_SOA() with an r, a g and a b plane. Both queues hold 255 items and
+// are timed on
+//
+//   item     enqueue() and dequeue() one item at a time, what main.c does
+//   scale    scale the red channel of every queued item in place, a channel at a time
+//   sum      add up the green channel of every queued item
+//
+// The last two walk the queue from head to tail in at most two runs (the queue wraps around).
+// On a plane those runs are contiguous bytes that the compiler can vectorise, in the array of
+// structs every third byte is used. The times are the best of -r runs, in ns per item.
+//
+// Usage: layout [-r runs] [-n passes]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../ring.h"
+
+struct _RGB {
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+};
+typedef struct _RGB RGB;
+
+#define RGB_FIELDS(X, a) X(uint8_t, r, a) X(uint8_t, g, a) X(uint8_t, b, a)
+
+#define LENGTH 256
+
+RING_DEFINE(RGBQueue, RGB, LENGTH)
+RING_DEFINE_SOA(RGBPlanes, RGB, RGB_FIELDS, LENGTH)
+
+static RGBQueue aos;
+static RGBPlanes soa;
+
+// Keeps the results alive
+static volatile uint32_t sink;
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Calls fn(first, count) for the one or two runs of slots from head to tail
+#define FOR_RUNS(q, fn) do {															\
+		uint8_t head_ = (q)->head, tail_ = (q)->tail;									\
+		if (tail_ >= head_) {															\
+			fn(head_, tail_ - head_);													\
+		} else {																		\
+			fn(head_, LENGTH - head_);													\
+			fn(0, tail_);																\
+		}																				\
+	} while (0)
+
+static void aos_item(void) {
+	for (int i = 0; i < LENGTH - 1; i++) {
+		RGB rgb = { i, i, i };
+		RGBQueue_enqueue(&aos, &rgb);
+	}
+	uint32_t sum = 0;
+	while (!RGBQueue_empty(&aos)) {
+		RGB rgb;
+		RGBQueue_dequeue(&aos, &rgb);
+		sum += rgb.r + rgb.g + rgb.b;
+	}
+	sink = sum;
+}
+
+static void soa_item(void) {
+	for (int i = 0; i < LENGTH - 1; i++) {
+		RGB rgb = { i, i, i };
+		RGBPlanes_enqueue(&soa, &rgb);
+	}
+	uint32_t sum = 0;
+	while (!RGBPlanes_empty(&soa)) {
+		RGB rgb;
+		RGBPlanes_dequeue(&soa, &rgb);
+		sum += rgb.r + rgb.g + rgb.b;
+	}
+	sink = sum;
+}
+
+static uint8_t scale = 200;
+static uint32_t total;
+
+#define AOS_SCALE(first, count) \
+	for (int i = first; i < (first) + (count); i++) aos.items[i].r = aos.items[i].r * scale >> 8
+#define SOA_SCALE(first, count) \
+	for (int i = first; i < (first) + (count); i++) soa.r[i] = soa.r[i] * scale >> 8
+#define AOS_SUM(first, count) \
+	for (int i = first; i < (first) + (count); i++) total += aos.items[i].g
+#define SOA_SUM(first, count) \
+	for (int i = first; i < (first) + (count); i++) total += soa.g[i]
+
+static void aos_scale(void) { FOR_RUNS(&aos, AOS_SCALE); }
+static void soa_scale(void) { FOR_RUNS(&soa, SOA_SCALE); }
+static void aos_sum(void) { total = 0; FOR_RUNS(&aos, AOS_SUM); sink = total; }
+static void soa_sum(void) { total = 0; FOR_RUNS(&soa, SOA_SUM); sink = total; }
+
+// Fills a queue with 255 items, starting half way, so that it wraps around
+static void fill(void) {
+	aos.head = aos.tail = soa.head = soa.tail = LENGTH / 2;
+	for (int i = 0; i < LENGTH - 1; i++) {
+		RGB rgb = { random(), random(), random() };
+		RGBQueue_enqueue(&aos, &rgb);
+		RGBPlanes_enqueue(&soa, &rgb);
+	}
+}
+
+// Best time of runs runs of passes calls, in ns per item. The queues start full, or empty for
+// the item passes, which fill them themselves.
+static double measure(void (*fn)(void), int full, int runs, int passes) {
+	double best = 1e30;
+	for (int r = 0; r < runs; r++) {
+		if (full)
+			fill();
+		else
+			aos.head = aos.tail = soa.head = soa.tail = LENGTH / 2;
+		double start = now_ns();
+		for (int p = 0; p < passes; p++)
+			fn();
+		double ns = (now_ns() - start) / passes / (LENGTH - 1);
+		if (ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: layout [-r runs] [-n passes]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	int runs = 5, passes = 20000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+		switch (opt) {
+		case 'r': runs = atoi(optarg); break;
+		case 'n': passes = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc || runs <= 0 || passes <= 0)
+		usage();
+
+	printf("layout      item   scale     sum   (ns per item)\n");
+	printf("aos      %7.3f %7.3f %7.3f\n", measure(aos_item, 0, runs, passes),
+		   measure(aos_scale, 1, runs, passes), measure(aos_sum, 1, runs, passes));
+	printf("soa      %7.3f %7.3f %7.3f\n", measure(soa_item, 0, runs, passes),
+		   measure(soa_scale, 1, runs, passes), measure(soa_sum, 1, runs, passes));
+	return 0;
+}
@@ -0,0 +1,78 @@
+// Name: logdec.c
+//
+// Decoder for the deferred log frames the firmware sends when it is built with LOG_DEFERRED
+// (see log.h). The format strings are read from the logfmt section of the firmware's ELF file,
+// the frames are read from a serial port, a pseudo terminal, a capture file or stdin, and the
+// text the firmware would have printed is written to stdout, one line at a time, so that it can
+// be piped into monitor:
+//
+//   logdec main.elf /dev/ttyUSB0 | monitor -
+//
+// Anything outside a frame is plain text and copied as is. Frames with an id that is not the
+// start of a format string are dropped, and counted on stderr at the end.
+//
+// Usage: logdec [-b baud] <main.elf> [port|file|-]
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "elf.h"
+#include "logfmt.h"
+#include "serial.h"
+
+static void usage(void) {
+	fprintf(stderr, "usage: logdec [-b baud] <main.elf> [port|file|-]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	long baud = 115200;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:")) != -1) {
+		switch (opt) {
+		case 'b': baud = strtol(optarg, NULL, 10); break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 && optind != argc - 2)
+		usage();
+
+	struct elf elf;
+	struct elf_section logfmt;
+	if (elf_open(&elf, argv[optind]) < 0)
+		return 1;
+	if (elf_find_section(&elf, "logfmt", &logfmt) < 0 || !logfmt.data) {
+		fprintf(stderr, "%s: no logfmt section, was it built with LOG_DEFERRED?\n", argv[optind]);
+		return 1;
+	}
+
+	int fd = serial_open(optind + 1 < argc ? argv[optind + 1] : "-", baud, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	struct logfmt_decoder decoder = { (const char *)logfmt.data, logfmt.size };
+	unsigned char buf[256];
+	char text[512];
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (ssize_t i = 0; i < n; i++) {
+			int r = logfmt_feed(&decoder, buf[i], text, sizeof(text));
+			if (r > 0)
+				fputs(text, stdout);
+			else if (r < 0)
+				putchar(buf[i]);
+			if (r > 0 || buf[i] == '\n')
+				fflush(stdout);
+		}
+	}
+
+	if (decoder.skipped)
+		fprintf(stderr, "logdec: %lu frames with an unknown id dropped\n", decoder.skipped);
+	elf_close(&elf);
+	return 0;
+}
@@ -0,0 +1,145 @@
+// Name: logfmt.c
+//
+// See logfmt.h
+
+#include <stdio.h>
+#include <string.h>
+
+#include "logfmt.h"
+
+#define NELEMS(x) (sizeof(x)/sizeof((x)[0]))
+
+// Parses the conversion specification after a '%', returns its length including the
+// conversion character and copies it, without length modifiers, to spec
+static size_t parse_spec(const char *p, char *spec, size_t size, char *conv) {
+	const char *start = p;
+	size_t len = 0;
+
+	spec[len++] = '%';
+	while (*p && strchr("-+ #0123456789.hlLjzt", *p)) {
+		if (!strchr("hlLjzt", *p) && len < size - 2)
+			spec[len++] = *p;
+		p++;
+	}
+	*conv = *p;
+	if (*p) {
+		spec[len++] = *p;
+		p++;
+	}
+	spec[len] = '\0';
+	return p - start;
+}
+
+size_t logfmt_args(const char *fmt) {
+	size_t n = 0;
+	while ((fmt = strchr(fmt, '%'))) {
+		if (fmt[1] == '%') {
+			fmt += 2;
+			continue;
+		}
+		char spec[32], conv;
+		fmt += 1 + parse_spec(fmt + 1, spec, sizeof(spec), &conv);
+		if (conv)
+			n++;
+	}
+	return n;
+}
+
+int logfmt_expand(char *out, size_t size, const char *fmt, const int16_t *args) {
+	size_t len = 0;
+
+	#define PUT(...) do {															\
+		int n_ = snprintf(out + len, len < size ? size - len : 0, __VA_ARGS__);	\
+		if (n_ > 0)																\
+			len += n_;															\
+	} while (0)
+
+	while (*fmt) {
+		if (*fmt != '%') {
+			const char *end = strchr(fmt, '%');
+			size_t n = end ? (size_t)(end - fmt) : strlen(fmt);
+			PUT("%.*s", (int)n, fmt);
+			fmt += n;
+			continue;
+		}
+		if (fmt[1] == '%') {
+			PUT("%%");
+			fmt += 2;
+			continue;
+		}
+
+		char spec[32], conv;
+		fmt += 1 + parse_spec(fmt + 1, spec, sizeof(spec), &conv);
+		if (!conv)
+			break;
+
+		int16_t v = *args++;
+		switch (conv) {
+		case 'd':
+		case 'i':
+			PUT(spec, (int)v);
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+			PUT(spec, (unsigned)(uint16_t)v);
+			break;
+		case 'c':
+			PUT(spec, (int)(uint8_t)v);
+			break;
+		default:
+			PUT("?");
+			break;
+		}
+	}
+	#undef PUT
+
+	if (size)
+		out[len < size ? len : size - 1] = '\0';
+	return len;
+}
+
+// An id is valid if it points at the start of a string in the table
+static int valid_id(const struct logfmt_decoder *d, uint16_t id) {
+	return id < d->table_size && (id == 0 || d->table[id - 1] == '\0') &&
+		   memchr(d->table + id, '\0', d->table_size - id);
+}
+
+int logfmt_feed(struct logfmt_decoder *d, uint8_t byte, char *out, size_t size) {
+	switch (d->state) {
+	case 0:
+		if (byte != LOG_SYNC)
+			return -1;
+		d->state = 1;
+		return 0;
+	case 1:
+		d->id = byte;
+		d->state = 2;
+		return 0;
+	case 2:
+		d->id |= byte << 8;
+		if (!valid_id(d, d->id) || (d->nargs = logfmt_args(d->table + d->id)) > NELEMS(d->args)) {
+			d->skipped++;
+			d->state = 0;
+			return 0;
+		}
+		d->state = 3;
+		break;
+	default: {
+		unsigned i = d->state - 3;
+		if (i % 2)
+			d->args[i / 2] |= byte << 8;
+		else
+			d->args[i / 2] = byte;
+		d->state++;
+		break;
+	}
+	}
+
+	if (d->state - 3 < 2 * d->nargs)
+		return 0;
+	d->state = 0;
+	logfmt_expand(out, size, d->table + d->id, d->args);
+	return 1;
+}
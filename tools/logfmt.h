@@ -0,0 +1,38 @@
+// Name: logfmt.h
+//
+// Expansion of the deferred log frames sent by LOG() in log.h when LOG_DEFERRED is defined.
+// Used by logdec, and by the host simulator to measure deferred builds.
+
+#ifndef LOGFMT_H
+#define LOGFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Must match log.h
+#define LOG_SYNC 0xfe
+
+// Number of arguments the format string takes
+size_t logfmt_args(const char *fmt);
+
+// Expands the format string with the given 16-bit arguments like snprintf() would have on the
+// AVR, returns the length of the text
+int logfmt_expand(char *out, size_t size, const char *fmt, const int16_t *args);
+
+// Frame decoder state, fed one byte at a time
+struct logfmt_decoder {
+	const char *table;			// contents of the logfmt section
+	size_t table_size;
+
+	unsigned state;				// bytes of the current frame seen so far, 0 outside a frame
+	uint16_t id;
+	size_t nargs;
+	int16_t args[32];
+	unsigned long skipped;		// frames dropped because of an unknown id
+};
+
+// Feeds one byte. Returns 1 with the expanded text in out when a frame completes, -1 if the byte
+// is not part of a frame (i.e. plain text), and 0 otherwise.
+int logfmt_feed(struct logfmt_decoder *d, uint8_t byte, char *out, size_t size);
+
+#endif // LOGFMT_H
@@ -0,0 +1,324 @@
+// Name: monitor.c
+//
+// Host side telemetry collector for the producer/consumer firmware.
+//
+// Reads the USART output of the firmware from a serial port, a pseudo terminal (e.g. the one
+// simavr creates for the UART), a capture file or a pipe (e.g. from tools/logdec), and parses
+// the lines the consumer prints:
+//
+//   <<<<< Consumed: (r, g, b) consuming every: N
+//   Queue is empty! Increased consume_every to: N
+//   ##### Telemetry: consumed C occupancy O underruns U every N
+//
+// The telemetry frames are only printed when the firmware is built with TELEMETRY_EVERY defined.
+// With PRODUCERS > 1 every line ends in "queue: n", and each queue is shown on a line of its own.
+//
+// Every -i ms the throughput of each queue over that interval is taken and appended to the CSV
+// file, if any, and the terminal is redrawn. The lines carry no time stamps, so the time is the
+// host's, of when they arrive. That makes no sense for a capture file, which is read in one go,
+// so a regular file only gives the totals: the throughput and the elapsed time are left out,
+// and the CSV file gets a single row per queue.
+//
+// Usage: monitor [-b baud] [-f f_cpu] [-q queue_length] [-i refresh_ms] [-c file.csv] [-n] <port|file|->
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "serial.h"
+
+#define NELEMS(x) (sizeof(x)/sizeof((x)[0]))
+
+// Queues shown, lines for other queues count as unparsed
+#define MAX_QUEUES 16
+
+// Everything we know about one queue, updated as lines arrive
+struct queue_stats {
+	uint32_t consumed;			// consumed lines seen
+	uint32_t underruns;			// "Queue is empty!" lines seen
+	int r, g, b;				// last item consumed
+	int consume_every;			// timer cycles between dequeues, as reported by the firmware
+	int occupancy;				// from the last telemetry frame, -1 if none seen yet
+	uint32_t fw_consumed;		// firmware side totals from the last telemetry frame
+	uint32_t fw_underruns;
+
+	uint32_t sample_consumed;	// consumed at the last sample
+	double throughput;			// over the last sample interval
+};
+
+struct stats {
+	struct queue_stats queue[MAX_QUEUES];
+	int queues;					// highest queue seen + 1
+	uint32_t bad_lines;			// lines we could not make sense of
+	char last_message[256];		// last line that was neither an item nor telemetry
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int sig) {
+	(void)sig;
+	quit = 1;
+}
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The queue a line is about, from its " queue: n" suffix, 0 without one, or NULL if it is out
+// of range
+static struct queue_stats *line_queue(const char *line, struct stats *s) {
+	const char *p = strstr(line, " queue: ");
+	int q = p ? atoi(p + 8) : 0;
+	if (q < 0 || q >= MAX_QUEUES)
+		return NULL;
+	for (; s->queues <= q; s->queues++)
+		s->queue[s->queues].occupancy = -1;
+	return &s->queue[q];
+}
+
+static int parse_consumed(const char *line, struct queue_stats *qs) {
+	const char *p = strstr(line, "Consumed: (");
+	if (!p)
+		return 0;
+
+	int r, g, b, every;
+	int n = sscanf(p, "Consumed: (%d, %d, %d) consuming every: %d", &r, &g, &b, &every);
+	if (n < 3)
+		return 0;
+
+	qs->consumed++;
+	qs->r = r;
+	qs->g = g;
+	qs->b = b;
+	if (n == 4)
+		qs->consume_every = every;
+	return 1;
+}
+
+static void parse_line(const char *line, struct stats *s) {
+	unsigned consumed, occupancy, underruns, every;
+	struct queue_stats *qs = line_queue(line, s);
+
+	if (strncmp(line, "<<<<<", 5) == 0) {
+		if (!qs || !parse_consumed(line, qs))
+			s->bad_lines++;
+	} else if (strncmp(line, "Queue is empty!", 15) == 0) {
+		if (!qs) {
+			s->bad_lines++;
+			return;
+		}
+		qs->underruns++;
+		if (sscanf(line, "Queue is empty! Increased consume_every to: %u", &every) == 1)
+			qs->consume_every = every;
+	} else if (sscanf(line, "##### Telemetry: consumed %u occupancy %u underruns %u every %u",
+					  &consumed, &occupancy, &underruns, &every) == 4) {
+		if (!qs) {
+			s->bad_lines++;
+			return;
+		}
+		qs->fw_consumed = consumed;
+		qs->occupancy = occupancy;
+		qs->fw_underruns = underruns;
+		qs->consume_every = every;
+	} else if (line[0]) {
+		snprintf(s->last_message, NELEMS(s->last_message), "%s", line);
+	}
+}
+
+// Takes the throughput of every queue since the last sample
+static void sample(struct stats *s, double elapsed) {
+	for (int q = 0; q < s->queues; q++) {
+		struct queue_stats *qs = &s->queue[q];
+		qs->throughput = elapsed > 0 ? (qs->consumed - qs->sample_consumed) / elapsed : 0;
+		qs->sample_consumed = qs->consumed;
+	}
+}
+
+// One row per queue, elapsed < 0 for a capture file, which has neither time nor throughput
+static void write_csv(const struct stats *s, double elapsed, FILE *csv) {
+	for (int q = 0; q < s->queues; q++) {
+		const struct queue_stats *qs = &s->queue[q];
+		if (elapsed >= 0)
+			fprintf(csv, "%.3f,%d,%u,%.2f,", elapsed, q, qs->consumed, qs->throughput);
+		else
+			fprintf(csv, ",%d,%u,,", q, qs->consumed);
+		fprintf(csv, "%d,%u,%d\n", qs->occupancy, qs->underruns, qs->consume_every);
+	}
+	fflush(csv);
+}
+
+static void draw(const struct stats *s, double elapsed, long f_cpu, int queue_length) {
+	// Nominal consumption rate: Timer 0 overflows every 256 * 256 clock cycles
+	double tick_hz = f_cpu / 65536.0;
+
+	printf("\033[H\033[2J");
+	if (elapsed >= 0)
+		printf("Producer/Consumer monitor                       elapsed %8.1f s\n\n", elapsed);
+	else
+		printf("Producer/Consumer monitor                  capture file, totals only\n\n");
+	printf("  queue   consumed    items/s  (nominal)  every  underruns  last item\n");
+	for (int q = 0; q < s->queues; q++) {
+		const struct queue_stats *qs = &s->queue[q];
+		double nominal = qs->consume_every > 0 ? tick_hz / qs->consume_every : 0;
+		printf("  %5d %10u ", q, qs->consumed);
+		if (elapsed >= 0)
+			printf("%10.1f", qs->throughput);
+		else
+			printf("%10s", "n/a");
+		printf(" %10.1f %6d %10u  (%d, %d, %d)", nominal, qs->consume_every, qs->underruns,
+			   qs->r, qs->g, qs->b);
+		if (qs->occupancy >= 0 && qs->fw_underruns != qs->underruns)
+			printf("  firmware reports %u underruns", qs->fw_underruns);
+		printf("\n");
+	}
+
+	printf("\n  occupancy\n");
+	for (int q = 0; q < s->queues; q++) {
+		const struct queue_stats *qs = &s->queue[q];
+		if (qs->occupancy < 0) {
+			printf("  %5d        n/a  (build the firmware with TELEMETRY_EVERY)\n", q);
+			continue;
+		}
+		int width = 40;
+		int filled = queue_length > 0 ? qs->occupancy * width / queue_length : 0;
+		if (filled > width)
+			filled = width;
+		printf("  %5d %5d / %d  [", q, qs->occupancy, queue_length);
+		for (int i = 0; i < width; i++)
+			putchar(i < filled ? '#' : '.');
+		printf("]\n");
+	}
+
+	if (s->bad_lines)
+		printf("\n  unparsed lines     %10u\n", s->bad_lines);
+	if (s->last_message[0])
+		printf("\n  %s\n", s->last_message);
+	fflush(stdout);
+}
+
+static void usage(void) {
+	fprintf(stderr,
+			"usage: monitor [-b baud] [-f f_cpu] [-q queue_length] [-i refresh_ms]\n"
+			"               [-c file.csv] [-n] <port|file|->\n"
+			"  -n  no terminal UI, only write the CSV file\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	long baud = 115200;
+	long f_cpu = 18432000;
+	int queue_length = 127;			// usable slots of the default 128 element queue
+	int refresh_ms = 250;
+	const char *csv_path = NULL;
+	int ui = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:f:q:i:c:n")) != -1) {
+		switch (opt) {
+		case 'b': baud = strtol(optarg, NULL, 10); break;
+		case 'f': f_cpu = strtol(optarg, NULL, 10); break;
+		case 'q': queue_length = atoi(optarg); break;
+		case 'i': refresh_ms = atoi(optarg); break;
+		case 'c': csv_path = optarg; break;
+		case 'n': ui = 0; break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 || refresh_ms <= 0 || f_cpu <= 0)
+		usage();
+
+	int fd = serial_open(argv[optind], baud, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	FILE *csv = NULL;
+	if (csv_path) {
+		csv = fopen(csv_path, "w");
+		if (!csv) {
+			fprintf(stderr, "monitor: %s: %s\n", csv_path, strerror(errno));
+			return 1;
+		}
+		fprintf(csv, "elapsed_s,queue,consumed,throughput,occupancy,underruns,consume_every\n");
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	struct stats s = { 0 };
+
+	struct stat st;
+	int capture = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+	char line[256];
+	size_t len = 0;
+	int eof = 0;
+
+	double start = now_seconds();
+	double last_sample = start;
+
+	while (!quit && !eof) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		int ready = poll(&pfd, 1, refresh_ms);
+
+		if (ready > 0) {
+			char chunk[512];
+			ssize_t n = read(fd, chunk, sizeof(chunk));
+			if (n <= 0) {
+				if (n < 0 && errno == EINTR)
+					continue;
+				eof = 1;
+			}
+			for (ssize_t i = 0; i < n; i++) {
+				char c = chunk[i];
+				if (c == '\n') {
+					line[len] = '\0';
+					parse_line(line, &s);
+					len = 0;
+				} else if (c != '\r' && len < sizeof(line) - 1) {
+					line[len++] = c;
+				}
+			}
+		} else if (ready < 0 && errno != EINTR) {
+			perror("monitor: poll");
+			break;
+		}
+
+		if (capture) {
+			if (eof && ui)
+				draw(&s, -1, f_cpu, queue_length);
+			if (eof && csv)
+				write_csv(&s, -1, csv);
+			continue;
+		}
+
+		double now = now_seconds();
+		if (eof || now - last_sample >= refresh_ms / 1000.0) {
+			sample(&s, now - last_sample);
+			last_sample = now;
+
+			if (ui)
+				draw(&s, now - start, f_cpu, queue_length);
+			if (csv)
+				write_csv(&s, now - start, csv);
+		}
+	}
+
+	if (csv)
+		fclose(csv);
+	if (!ui) {
+		for (int q = 0; q < s.queues; q++)
+			printf("queue %d: %u items consumed, %u underruns\n", q, s.queue[q].consumed,
+				   s.queue[q].underruns);
+	}
+	return 0;
+}
@@ -0,0 +1,148 @@
+// Name: pair.c
+//
+// Runs two host simulator builds as two boards wired together (see ../host/sim.c): the SPI
+// bytes the first one sends as master go to the second one's SPI slave, the port B outputs of
+// each one are the other one's PINB inputs, and both keep to the same virtual clock. e.g.
+//
+//   pair -s 2 ../host/build/spi_master/spi_link ../host/build/spi_slave/spi_link
+//
+// Each command is run with SIM_LINK_FD set to its end of a socket pair. Their output (the
+// USART and the simulator's report) is copied to stdout a line at a time, behind "1: " or
+// "2: ". When one of them stops, so does the other one.
+//
+// Usage: pair [-s seconds] [-c cycles] command1 command2
+//   -s  virtual seconds to run for (SIM_SECONDS), default until interrupted
+//   -c  cycles between synchronisations (SIM_LINK_CYCLES)
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct board {
+	pid_t pid;
+	int out;				// its stdout and stderr, -1 once closed
+	char line[4096];
+	size_t len;
+};
+
+// Runs command with SIM_LINK_FD=link, and its output going to a pipe
+static int spawn(struct board *board, const char *command, int link, int other) {
+	int out[2];
+	if (pipe(out) < 0) {
+		perror("pair: pipe");
+		return -1;
+	}
+
+	board->pid = fork();
+	if (board->pid < 0) {
+		perror("pair: fork");
+		return -1;
+	}
+	if (board->pid == 0) {
+		char fd[16];
+		snprintf(fd, sizeof(fd), "%d", link);
+		setenv("SIM_LINK_FD", fd, 1);
+		close(other);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(out[1], STDERR_FILENO);
+		close(out[0]);
+		close(out[1]);
+		execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+		perror("pair: sh");
+		_exit(127);
+	}
+
+	close(out[1]);
+	board->out = out[0];
+	board->len = 0;
+	return 0;
+}
+
+// Copies the complete lines read from the board, and the rest too at the end
+static void drain(struct board *board, int number) {
+	ssize_t n = read(board->out, board->line + board->len, sizeof(board->line) - board->len);
+	if (n < 0 && errno == EINTR)
+		return;
+	if (n <= 0) {
+		if (board->len)
+			printf("%d: %.*s\n", number, (int)board->len, board->line);
+		close(board->out);
+		board->out = -1;
+		return;
+	}
+	board->len += n;
+
+	char *start = board->line, *end;
+	while ((end = memchr(start, '\n', board->line + board->len - start))) {
+		printf("%d: %.*s\n", number, (int)(end - start), start);
+		start = end + 1;
+	}
+	board->len -= start - board->line;
+	memmove(board->line, start, board->len);
+
+	// A line too long for the buffer is cut
+	if (board->len == sizeof(board->line)) {
+		printf("%d: %.*s\n", number, (int)board->len, board->line);
+		board->len = 0;
+	}
+	fflush(stdout);
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: pair [-s seconds] [-c cycles] command1 command2\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "s:c:")) != -1) {
+		switch (opt) {
+		case 's': setenv("SIM_SECONDS", optarg, 1); break;
+		case 'c': setenv("SIM_LINK_CYCLES", optarg, 1); break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 2)
+		usage();
+
+	int link[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, link) < 0) {
+		perror("pair: socketpair");
+		return 1;
+	}
+
+	struct board boards[2];
+	for (int i = 0; i < 2; i++)
+		if (spawn(&boards[i], argv[optind + i], link[i], link[1 - i]) < 0)
+			return 1;
+	close(link[0]);
+	close(link[1]);
+
+	while (boards[0].out >= 0 || boards[1].out >= 0) {
+		struct pollfd fds[2];
+		for (int i = 0; i < 2; i++)
+			fds[i] = (struct pollfd){ boards[i].out, POLLIN, 0 };
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("pair: poll");
+			return 1;
+		}
+		for (int i = 0; i < 2; i++)
+			if (fds[i].revents)
+				drain(&boards[i], i + 1);
+	}
+
+	int failed = 0;
+	for (int i = 0; i < 2; i++) {
+		int status;
+		if (waitpid(boards[i].pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	}
+	return failed;
+}
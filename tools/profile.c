@@ -0,0 +1,202 @@
+// Name: profile.c
+//
+// Turns the histograms the firmware sends when it is built with PROFILE (see profile.h) into a
+// per function profile. The dumps are read from a serial port, a pseudo terminal (e.g. simavr's),
+// a capture file or stdin and added up, and every bucket's samples are shared out among the
+// functions of main.elf that overlap its address range, by the number of bytes they cover.
+// Samples in parts of a bucket no function covers go to "(unknown)".
+//
+//   profile main.elf /dev/ttyUSB0
+//
+// Builds with LOG_DEFERRED are decoded with the format strings in main.elf, as logdec does. The
+// profile is printed when the input ends or on Ctrl-C, and with -i after every dump as well.
+//
+// Usage: profile [-b baud] [-i] <main.elf> [port|file|-]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elf.h"
+#include "logfmt.h"
+#include "serial.h"
+
+#define MAX_BUCKETS 1024
+
+struct function {
+	const char *name;
+	uint64_t start, end;
+	double samples;
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int sig) {
+	(void)sig;
+	quit = 1;
+}
+
+static struct function *functions;
+static size_t nfunctions;
+
+static uint64_t hist[MAX_BUCKETS];
+static uint64_t samples, outside;
+static unsigned bucket_bytes;
+static unsigned dumps;
+
+static int by_samples(const void *a, const void *b) {
+	const struct function *fa = a, *fb = b;
+	return fa->samples < fb->samples ? 1 : fa->samples > fb->samples ? -1 : 0;
+}
+
+static int load_functions(const struct elf *elf) {
+	struct elf_symbol *syms;
+	long n = elf_functions(elf, &syms);
+	if (n < 0)
+		return -1;
+
+	functions = malloc((n ? n : 1) * sizeof(*functions));
+	for (long i = 0; i < n; i++)
+		functions[i] = (struct function){ syms[i].name, syms[i].value,
+										  syms[i].value + syms[i].size, 0 };
+	nfunctions = n;
+	free(syms);
+	return 0;
+}
+
+static void print_profile(void) {
+	if (!bucket_bytes) {
+		fprintf(stderr, "profile: no dumps seen, was the firmware built with PROFILE?\n");
+		return;
+	}
+
+	struct function *f = malloc((nfunctions + 1) * sizeof(*f));
+	memcpy(f, functions, nfunctions * sizeof(*f));
+	struct function *unknown = &f[nfunctions];
+	*unknown = (struct function){ "(unknown)", 0, 0, outside };
+
+	for (size_t b = 0; b < MAX_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		uint64_t start = (uint64_t)b * bucket_bytes, end = start + bucket_bytes;
+		uint64_t covered = 0;
+		for (size_t i = 0; i < nfunctions; i++) {
+			uint64_t from = f[i].start > start ? f[i].start : start;
+			uint64_t to = f[i].end < end ? f[i].end : end;
+			if (from < to) {
+				f[i].samples += (double)hist[b] * (to - from) / bucket_bytes;
+				covered += to - from;
+			}
+		}
+		if (covered < bucket_bytes)
+			unknown->samples += (double)hist[b] * (bucket_bytes - covered) / bucket_bytes;
+	}
+
+	qsort(f, nfunctions + 1, sizeof(*f), by_samples);
+	printf("%llu samples in %u dumps, %u bytes per bucket\n\n", (unsigned long long)samples,
+		   dumps, bucket_bytes);
+	printf("   %%time    samples  function\n");
+	for (size_t i = 0; i < nfunctions + 1 && f[i].samples > 0; i++)
+		printf("  %6.2f %10.1f  %s\n", samples ? 100 * f[i].samples / samples : 0.0,
+			   f[i].samples, f[i].name);
+	fflush(stdout);
+	free(f);
+}
+
+static void parse_line(const char *line, int print_dumps) {
+	unsigned count, bytes, other, bucket;
+
+	if (sscanf(line, "##### Profile: %u samples, %u bytes per bucket, %u outside",
+			   &count, &bytes, &other) == 3) {
+		if (bucket_bytes && bytes != bucket_bytes)
+			fprintf(stderr, "profile: bucket size changed from %u to %u bytes\n",
+					bucket_bytes, bytes);
+		bucket_bytes = bytes;
+		samples += count;
+		outside += other;
+	} else if (sscanf(line, "##### Profile: bucket %u samples %u", &bucket, &count) == 2) {
+		if (bucket < MAX_BUCKETS)
+			hist[bucket] += count;
+	} else if (strncmp(line, "##### Profile: end", 18) == 0) {
+		dumps++;
+		if (print_dumps) {
+			print_profile();
+			printf("\n");
+		}
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: profile [-b baud] [-i] <main.elf> [port|file|-]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	long baud = 115200;
+	int print_dumps = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:i")) != -1) {
+		switch (opt) {
+		case 'b': baud = strtol(optarg, NULL, 10); break;
+		case 'i': print_dumps = 1; break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 && optind != argc - 2)
+		usage();
+
+	struct elf elf;
+	struct elf_section logfmt = { 0 };
+	if (elf_open(&elf, argv[optind]) < 0 || load_functions(&elf) < 0)
+		return 1;
+	elf_find_section(&elf, "logfmt", &logfmt);
+
+	int fd = serial_open(optind + 1 < argc ? argv[optind + 1] : "-", baud, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	// Without SA_RESTART, so that Ctrl-C ends a blocking read()
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	struct logfmt_decoder decoder = { (const char *)logfmt.data, logfmt.data ? logfmt.size : 0 };
+	unsigned char buf[256];
+	char text[512], line[512];
+	size_t len = 0;
+	ssize_t n;
+
+	while (!quit && (n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("profile: read");
+			break;
+		}
+		for (ssize_t i = 0; i < n; i++) {
+			int r = logfmt_feed(&decoder, buf[i], text, sizeof(text));
+			const char *p = r > 0 ? text : r < 0 ? (const char *)&buf[i] : "";
+			size_t plen = r > 0 ? strlen(text) : r < 0;
+			for (size_t j = 0; j < plen; j++) {
+				if (p[j] == '\n') {
+					line[len] = '\0';
+					parse_line(line, print_dumps);
+					len = 0;
+				} else if (p[j] != '\r' && len < sizeof(line) - 1) {
+					line[len++] = p[j];
+				}
+			}
+		}
+	}
+
+	print_profile();
+	free(functions);
+	elf_close(&elf);
+	return 0;
+}
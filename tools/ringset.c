@@ -0,0 +1,76 @@
+// Name: ringset.c
+//
+// Waiting on many rings at once, see ringset.h
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "ringset.h"
+
+int ringset_init(RingSet *set) {
+	memset(set, 0, sizeof(*set));
+	set->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (set->fd < 0) {
+		perror("eventfd");
+		return -1;
+	}
+	return 0;
+}
+
+void ringset_close(RingSet *set) {
+	close(set->fd);
+	set->fd = -1;
+}
+
+// The slow path of ringset_notify(). Only one producer disarms a ring, and only the one that
+// makes the ready set non-empty writes the eventfd.
+void ringset_wake_(RingSet *set, uint64_t bit) {
+	if (!(__atomic_fetch_and(&set->armed, ~bit, __ATOMIC_ACQ_REL) & bit))
+		return;
+	if (__atomic_fetch_or(&set->ready, bit, __ATOMIC_ACQ_REL))
+		return;
+
+	uint64_t one = 1;
+	if (write(set->fd, &one, sizeof(one)) != sizeof(one)) {
+		perror("ringset: eventfd");
+		exit(1);
+	}
+	__atomic_fetch_add(&set->wakeups, 1, __ATOMIC_RELAXED);
+}
+
+// Resets the eventfd, then takes the ready rings. A ring that becomes ready in between leaves
+// the eventfd readable, which at worst costs a spurious wake-up later.
+static uint64_t take_ready(RingSet *set) {
+	uint64_t count;
+	if (read(set->fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		perror("ringset: eventfd");
+		exit(1);
+	}
+	return __atomic_exchange_n(&set->ready, 0, __ATOMIC_ACQ_REL);
+}
+
+uint64_t ringset_wait(RingSet *set, int timeout_ms) {
+	// Called for a readable ringset_fd(), which must not stay readable
+	if (timeout_ms == 0)
+		return take_ready(set);
+
+	// Rings that became ready while the consumer was busy need no system call
+	uint64_t ready = __atomic_exchange_n(&set->ready, 0, __ATOMIC_ACQ_REL);
+	while (!ready) {
+		struct pollfd pfd = { .fd = set->fd, .events = POLLIN };
+		int n = poll(&pfd, 1, timeout_ms);
+		if (n < 0 && errno != EINTR) {
+			perror("ringset: poll");
+			exit(1);
+		}
+		if (n == 0)
+			return 0;
+		ready = take_ready(set);
+	}
+	return ready;
+}
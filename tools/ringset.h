@@ -0,0 +1,83 @@
+// Name: ringset.h
+//
+// Waiting on many rings at once, for a host consumer that drains the rings of several producer
+// threads. Instead of polling every ring, the consumer sleeps until one of them has items, and
+// wakes up with the set of rings that got some:
+//
+//   RingSet set;
+//   ringset_init(&set);
+//
+//   producer of ring i:  RGBQueue_enqueue(&q[i], &rgb); ringset_notify(&set, i);
+//
+//   consumer:            uint64_t ready = all rings;
+//                        for (;;) {
+//                            for each ring i in ready {
+//                                drain q[i]
+//                                ringset_arm(&set, i);
+//                                if (!RGBQueue_empty(&q[i]))   // came in before arming
+//                                    keep i for the next round without waiting
+//                            }
+//                            if nothing was kept
+//                                ready = ringset_wait(&set, -1);
+//                        }
+//
+// A ring is armed by the consumer once it has found it empty. The first notify after that
+// disarms it, marks it ready and, if it is the first ready ring since the consumer last
+// looked, writes to the set's eventfd. Every other notify, which is nearly all of them while
+// the consumer keeps up, costs the producer a memory fence and a load. So there is at most one
+// system call on either side per ring going from empty to not empty, and none per item.
+//
+// The fence orders the producer's enqueue before its look at the armed rings, and the one in
+// ringset_arm() the consumer's arming before its look at the ring, so that at least one of the
+// two sees the other: either the producer sees the ring armed and wakes the consumer, or the
+// consumer sees the item. A wake-up for a ring that has been drained meanwhile is harmless.
+//
+// A set takes up to RINGSET_MAX rings, each with one producer. ringset_fd() can go into the
+// consumer's own poll() or epoll set next to other descriptors, it becomes readable once a
+// ring is ready, and ringset_wait() with a timeout of 0 then returns the ready rings.
+
+#ifndef RINGSET_H
+#define RINGSET_H
+
+#include <stdint.h>
+
+#define RINGSET_MAX 64
+
+typedef struct {
+	uint64_t armed;		// rings the consumer found empty and waits for
+	uint64_t ready;		// rings notified since the consumer last looked
+	int fd;				// eventfd, written when ready goes from none to some
+	uint64_t wakeups;	// eventfd writes so far
+} RingSet;
+
+// Sets up an empty set. Prints an error and returns -1 on failure.
+int ringset_init(RingSet *set);
+
+void ringset_close(RingSet *set);
+
+// The slow path of ringset_notify(), only called when the consumer is armed for the ring
+void ringset_wake_(RingSet *set, uint64_t bit);
+
+// Wakes the consumer with this ring if it is waiting for it (producer side)
+static inline void ringset_notify(RingSet *set, uint8_t ring) {
+	uint64_t bit = (uint64_t)1 << ring;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&set->armed, __ATOMIC_RELAXED) & bit)
+		ringset_wake_(set, bit);
+}
+
+// Marks the ring as found empty, the consumer must look at it again afterwards (consumer side)
+static inline void ringset_arm(RingSet *set, uint8_t ring) {
+	__atomic_fetch_or(&set->armed, (uint64_t)1 << ring, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// Waits up to timeout_ms (-1 for ever) for armed rings to be notified, and returns them, 0 on
+// timeout (consumer side)
+uint64_t ringset_wait(RingSet *set, int timeout_ms);
+
+static inline int ringset_fd(const RingSet *set) {
+	return set->fd;
+}
+
+#endif // RINGSET_H
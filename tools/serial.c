@@ -0,0 +1,53 @@
+// Name: serial.c
+//
+// See serial.h
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "serial.h"
+
+static speed_t baud_to_speed(long baud) {
+	switch (baud) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	default: return 0;
+	}
+}
+
+int serial_open(const char *path, long baud, int flags) {
+	if (strcmp(path, "-") == 0)
+		return STDIN_FILENO;
+
+	int fd = open(path, flags | O_NOCTTY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (isatty(fd)) {
+		struct termios tio;
+		speed_t speed = baud_to_speed(baud);
+		if (!speed) {
+			fprintf(stderr, "%s: unsupported baud rate %ld\n", path, baud);
+			close(fd);
+			return -1;
+		}
+		tcgetattr(fd, &tio);
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	return fd;
+}
@@ -0,0 +1,13 @@
+// Name: serial.h
+//
+// Opening the firmware's USART on the host side, shared by the tools.
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+// Opens path with the given open() flags, "-" being stdin. Serial ports and pseudo terminals
+// are switched to raw mode at the given baud rate, anything else is used as is. Prints an error
+// and returns -1 on failure.
+int serial_open(const char *path, long baud, int flags);
+
+#endif // SERIAL_H
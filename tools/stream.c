@@ -0,0 +1,313 @@
+// Name: stream.c
+//
+// Streams RGB frames into the uart_rx.c firmware as fast as it takes them, to measure the end
+// to end throughput from the PC to the LEDs.
+//
+// The frames are raw pixel data, 3 bytes per pixel, read from a file (which is sent once) or
+// made up on the fly (a rainbow that moves by one step per frame). They go to a serial port or
+// pseudo terminal, or to the host simulator: with -e the command is run with SIM_RX=- and its
+// stdin and stdout connected to this tool, e.g.
+//
+//   stream -e ../host/build/uart_rx -n 1000
+//
+// Flow control matches the firmware's FLOW_CONTROL:
+//
+//   -x  XON/XOFF (default): no data is written between an XOFF and the next XON from the
+//       firmware. To keep what is already on its way small, no more than -l bytes are written
+//       ahead into the serial port's output queue.
+//   -r  RTS/CTS, done by the serial driver. Every time CTS goes away counts as a stall.
+//   -N  none
+//
+// Everything else the firmware sends is copied to stdout. Once a second, and when done, the
+// frames per second and the stalls (XOFFs or CTS drops) so far are printed on stderr, with the
+// share of the time the firmware had the sender stopped. These use the wall clock, so for the
+// simulator, whose time runs at a different pace, see the rate it reports itself.
+//
+// Usage: stream [-b baud] [-p pixels] [-n frames] [-f file] [-l lag] [-x|-r|-N] <port|-e command>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serial.h"
+
+#define XON		0x11
+#define XOFF	0x13
+
+enum flow { FLOW_NONE, FLOW_XONXOFF, FLOW_RTS };
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int sig) {
+	(void)sig;
+	quit = 1;
+}
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs command with SIM_RX=- and returns the ends of its stdin and stdout
+static pid_t spawn(const char *command, int *to_child, int *from_child) {
+	int in[2], out[2];
+	if (pipe(in) < 0 || pipe(out) < 0) {
+		perror("stream: pipe");
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("stream: fork");
+		return -1;
+	}
+	if (pid == 0) {
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		setenv("SIM_RX", "-", 1);
+		execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+		perror("stream: sh");
+		_exit(127);
+	}
+
+	close(in[0]);
+	close(out[1]);
+	*to_child = in[1];
+	*from_child = out[0];
+	return pid;
+}
+
+// Position on the colour wheel, 0-255
+static void wheel(uint8_t pos, uint8_t *rgb) {
+	uint8_t third = pos % 85 * 3;
+	if (pos < 85) {
+		rgb[0] = 255 - third; rgb[1] = third; rgb[2] = 0;
+	} else if (pos < 170) {
+		rgb[0] = 0; rgb[1] = 255 - third; rgb[2] = third;
+	} else {
+		rgb[0] = third; rgb[1] = 0; rgb[2] = 255 - third;
+	}
+}
+
+// Fills the next frame, returns 0 when there is none
+static int next_frame(FILE *file, uint8_t *frame, int pixels, uint32_t number) {
+	if (file)
+		return fread(frame, 3, pixels, file) == (size_t)pixels;
+
+	for (int i = 0; i < pixels; i++)
+		wheel((uint8_t)(i * 256 / pixels + number), &frame[i * 3]);
+	return 1;
+}
+
+static void report(uint32_t frames, uint32_t stalls, double stopped, double elapsed, int done) {
+	fprintf(stderr, "stream: %u frames, %.1f frames/s, %u stalls, stopped %.0f%% of the time%c",
+			frames, elapsed > 0 ? frames / elapsed : 0.0, stalls,
+			elapsed > 0 ? 100 * stopped / elapsed : 0.0, done ? '\n' : '\r');
+}
+
+static void usage(void) {
+	fprintf(stderr,
+			"usage: stream [-b baud] [-p pixels] [-n frames] [-f file] [-l lag] [-x|-r|-N]\n"
+			"              <port|-e command>\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	long baud = 115200;
+	int pixels = 64;
+	uint32_t max_frames = 0;
+	const char *path = NULL;
+	const char *command = NULL;
+	int lag = 16;
+	enum flow flow = FLOW_XONXOFF;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:p:n:f:l:e:xrN")) != -1) {
+		switch (opt) {
+		case 'b': baud = strtol(optarg, NULL, 10); break;
+		case 'p': pixels = atoi(optarg); break;
+		case 'n': max_frames = strtoul(optarg, NULL, 10); break;
+		case 'f': path = optarg; break;
+		case 'l': lag = atoi(optarg); break;
+		case 'e': command = optarg; break;
+		case 'x': flow = FLOW_XONXOFF; break;
+		case 'r': flow = FLOW_RTS; break;
+		case 'N': flow = FLOW_NONE; break;
+		default: usage();
+		}
+	}
+	if (pixels <= 0 || lag <= 0 || (command ? optind != argc : optind != argc - 1))
+		usage();
+
+	FILE *file = NULL;
+	if (path && !(file = fopen(path, "rb"))) {
+		fprintf(stderr, "stream: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	int out_fd, in_fd;
+	pid_t child = -1;
+	if (command) {
+		if ((child = spawn(command, &out_fd, &in_fd)) < 0)
+			return 1;
+	} else {
+		if ((out_fd = in_fd = serial_open(argv[optind], baud, O_RDWR)) < 0)
+			return 1;
+	}
+
+	int tty = isatty(out_fd);
+	if (tty && flow == FLOW_RTS) {
+		struct termios tio;
+		tcgetattr(out_fd, &tio);
+		tio.c_cflag |= CRTSCTS;
+		tcsetattr(out_fd, TCSANOW, &tio);
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	uint8_t *frame = malloc(pixels * 3);
+	size_t frame_pos = 0, frame_len = 0;
+	uint32_t frames = 0, stalls = 0;
+	int stopped = 0;
+	int cts = 1;
+	int eof = 0;
+
+	double start = now_seconds();
+	double last_report = start;
+	double stopped_since = 0, stopped_total = 0;
+
+	while (!quit && !eof) {
+		if (frame_pos == frame_len && out_fd >= 0) {
+			if ((max_frames && frames == max_frames) || !next_frame(file, frame, pixels, frames)) {
+				// Done, the simulator exits once its input ends
+				if (command)
+					close(out_fd);
+				else
+					tcdrain(out_fd);
+				out_fd = -1;
+				if (!command)
+					break;
+			} else {
+				frame_pos = 0;
+				frame_len = pixels * 3;
+			}
+		}
+
+		// On a tty, only let a few bytes queue up in the driver, see above
+		int room = frame_len - frame_pos;
+		int queued = 0;
+		if (tty && out_fd >= 0 && ioctl(out_fd, TIOCOUTQ, &queued) == 0)
+			room = queued < lag ? (lag - queued < room ? lag - queued : room) : 0;
+
+		if (tty && flow == FLOW_RTS) {
+			int lines = 0;
+			if (ioctl(out_fd, TIOCMGET, &lines) == 0) {
+				int now_cts = !!(lines & TIOCM_CTS);
+				if (cts && !now_cts) {
+					stalls++;
+					stopped_since = now_seconds();
+				} else if (!cts && now_cts) {
+					stopped_total += now_seconds() - stopped_since;
+				}
+				cts = now_cts;
+			}
+		}
+
+		int sending = out_fd >= 0 && !stopped && room > 0;
+		struct pollfd pfd[2] = {
+			{ .fd = in_fd, .events = POLLIN },
+			{ .fd = sending ? out_fd : -1, .events = POLLOUT },
+		};
+		// A full driver queue does not wake poll(), so look again soon
+		int wait = out_fd >= 0 && !stopped && room == 0 ? 1 : 100;
+		int ready = poll(pfd, 2, wait);
+		if (ready < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("stream: poll");
+			break;
+		}
+
+		if (pfd[0].revents) {
+			uint8_t chunk[512], text[512];
+			size_t len = 0;
+			ssize_t n = read(in_fd, chunk, sizeof(chunk));
+			if (n <= 0) {
+				if (n < 0 && errno == EINTR)
+					continue;
+				eof = 1;
+			}
+			for (ssize_t i = 0; i < n; i++) {
+				if (flow == FLOW_XONXOFF && chunk[i] == XOFF) {
+					if (!stopped) {
+						stopped = 1;
+						stalls++;
+						stopped_since = now_seconds();
+					}
+				} else if (flow == FLOW_XONXOFF && chunk[i] == XON) {
+					if (stopped) {
+						stopped = 0;
+						stopped_total += now_seconds() - stopped_since;
+					}
+				} else {
+					text[len++] = chunk[i];
+				}
+			}
+			if (len) {
+				fwrite(text, 1, len, stdout);
+				fflush(stdout);
+			}
+		}
+
+		if (pfd[1].revents & (POLLERR | POLLHUP)) {
+			fprintf(stderr, "stream: output closed\n");
+			break;
+		}
+		if (pfd[1].revents & POLLOUT) {
+			ssize_t n = write(out_fd, frame + frame_pos, room);
+			if (n < 0 && errno != EINTR && errno != EAGAIN) {
+				perror("stream: write");
+				break;
+			}
+			if (n > 0 && (frame_pos += n) == frame_len)
+				frames++;
+		}
+
+		double now = now_seconds();
+		if (now - last_report >= 1) {
+			last_report = now;
+			report(frames, stalls, stopped_total, now - start, 0);
+		}
+	}
+
+	if (stopped || !cts)
+		stopped_total += now_seconds() - stopped_since;
+	report(frames, stalls, stopped_total, now_seconds() - start, 1);
+
+	if (child > 0) {
+		if (quit)
+			kill(child, SIGTERM);
+		waitpid(child, NULL, 0);
+	}
+	if (file)
+		fclose(file);
+	free(frame);
+	return 0;
+}
@@ -0,0 +1,106 @@
+// Name: window.c
+//
+// Checks the windows of window.h against a brute-force rescan of the last N values after every
+// push, for random values in windows of a few lengths and value types:
+//
+//   short    7 uint8_t values, the shortest window that still wraps its monotonic queues often
+//   adc      64 uint16_t values with 10-bit samples, what adc.c uses
+//   signed   255 int16_t values, the longest window and negative values
+//
+// The values come from a narrow range part of the time, so that equal values, which the
+// monotonic queues must keep in order, occur often. Exits with status 1 on the first mismatch.
+//
+// Usage: window [-n pushes] [-s seed]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../window.h"
+
+WINDOW_DEFINE(ShortWindow, uint8_t, uint16_t, 7)
+WINDOW_DEFINE(AdcWindow, uint16_t, uint32_t, 64)
+WINDOW_DEFINE(SignedWindow, int16_t, int32_t, 255)
+
+// Compares a window with a rescan of the last length values of history, which holds the
+// values pushed so far, n of them
+#define CHECK(name, Window, w, history, n, length) do {									\
+		long count_ = (n) < (length) ? (n) : (length);									\
+		long sum_ = 0, min_ = (history)[(n) - 1], max_ = min_;							\
+		for (long i_ = (n) - count_; i_ < (n); i_++) {									\
+			sum_ += (history)[i_];														\
+			if ((history)[i_] < min_)													\
+				min_ = (history)[i_];													\
+			if ((history)[i_] > max_)													\
+				max_ = (history)[i_];													\
+		}																				\
+		if (Window##_count(w) != count_ || Window##_sum(w) != sum_ ||					\
+			Window##_mean(w) != sum_ / count_ ||										\
+			Window##_min(w) != min_ || Window##_max(w) != max_) {						\
+			printf("%s: mismatch after %ld pushes: count %d/%ld sum %ld/%ld "				\
+				   "mean %ld/%ld min %ld/%ld max %ld/%ld\n", (name), (long)(n),			\
+				   Window##_count(w), count_, (long)Window##_sum(w), sum_,				\
+				   (long)Window##_mean(w), sum_ / count_,								\
+				   (long)Window##_min(w), min_, (long)Window##_max(w), max_);			\
+			exit(1);																	\
+		}																				\
+	} while (0)
+
+// A random value in [low, high], from [low, low + 3] for a stretch now and then
+static long value(long low, long high) {
+	static long narrow;
+	if (narrow) {
+		narrow--;
+		return low + random() % 4;
+	}
+	if (random() % 64 == 0)
+		narrow = random() % 32;
+	return low + random() % (high - low + 1);
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: window [-n pushes] [-s seed]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	long pushes = 100000;
+	unsigned seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n': pushes = atol(optarg); break;
+		case 's': seed = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if (pushes < 1)
+		usage();
+	srandom(seed);
+
+	uint8_t *short_values = malloc(pushes * sizeof(*short_values));
+	uint16_t *adc_values = malloc(pushes * sizeof(*adc_values));
+	int16_t *signed_values = malloc(pushes * sizeof(*signed_values));
+	static ShortWindow short_window;
+	static AdcWindow adc_window;
+	static SignedWindow signed_window;
+
+	for (long n = 1; n <= pushes; n++) {
+		short_values[n - 1] = value(0, 255);
+		ShortWindow_push(&short_window, short_values[n - 1]);
+		CHECK("short", ShortWindow, &short_window, short_values, n, 7);
+
+		adc_values[n - 1] = value(0, 1023);
+		AdcWindow_push(&adc_window, adc_values[n - 1]);
+		CHECK("adc", AdcWindow, &adc_window, adc_values, n, 64);
+
+		signed_values[n - 1] = value(-32768, 32767);
+		SignedWindow_push(&signed_window, signed_values[n - 1]);
+		CHECK("signed", SignedWindow, &signed_window, signed_values, n, 255);
+	}
+
+	printf("short, adc and signed windows match a rescan after each of %ld pushes\n", pushes);
+	return 0;
+}
@@ -0,0 +1,245 @@
+// Name: twi.c
+//
+// The producer/consumer example from main.c with an I2C LED driver as the output. The queue
+// carries RGB items as before, and the consumer is the TWI interrupt: a state machine that
+// turns each item into a register write to a PCA9685 16-channel PWM driver and sends it one
+// byte per interrupt. Neither main() nor a timer ISR ever waits for the bus.
+//
+// The items go to 5 RGB LEDs in turn, on channels 0 to 14. Each one is a transaction of its
+// own: START, the driver's address, the register of the LED's red channel, the ON and OFF
+// times of its red, green and blue channels (12 bytes, the driver moves on to the next
+// register by itself), STOP. The 8-bit colour is scaled to the 12-bit OFF time, and 0 and 255
+// use the full off and full on bits, since the counter never reaches 4096.
+//
+// When a transaction is done the ISR asks for STOP and START together, which the TWI sends
+// back to back, so the next item follows without a round trip through main(). When the queue
+// is empty it only sends STOP and the bus goes idle, until the producer starts it again after
+// its next enqueue. The first transaction wakes the driver up with auto increment on.
+//
+// The producer keeps the queue full, so the items go out as fast as the bus allows, and main()
+// prints the items and bytes per second. In the host simulator, at 18.432 MHz:
+//
+//   TWI_KHZ=100   692 items/s    9688 bytes/s
+//   TWI_KHZ=400  2056 items/s   28784 bytes/s
+//
+// 14 bytes and a STOP and START per item would be 781 and 3125 items/s with no time between
+// the bytes. The rest is the interrupt, which the bus waits for with SCL held low. The
+// simulator charges 200 cycles (11 us) for each one, a large part of the 23 us a byte takes
+// at 400 kHz.
+//
+// Build with "make TARGET=twi", or "make TARGET=twi DEFS=-DTWI_KHZ=400" for fast mode. SDA (PC4)
+// and SCL (PC5) need pull-up resistors, the internal ones are too weak for 400 kHz.
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/twi.h>
+
+// Only main() prints, so that the ISR is never held off for the length of a line
+#define LOG_SINGLE_CONTEXT
+#include "example.h"
+#include "log.h"
+#include "ring.h"
+#include "sched.h"
+
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 16
+#endif
+
+// SCL frequency, 100 (standard mode) or 400 (fast mode)
+#ifndef TWI_KHZ
+#define TWI_KHZ 100
+#endif
+
+// SCL = F_CPU / (16 + 2 * TWBR), with the prescaler at 1
+#define TWI_BITRATE ((F_CPU / 1000 / TWI_KHZ - 16) / 2)
+
+#if TWI_BITRATE < 1 || TWI_BITRATE > 255
+#error "TWI_KHZ is out of range for F_CPU"
+#endif
+
+// Print the throughput every this many ms, at most 455 (see sched.h)
+#ifndef REPORT_MS
+#define REPORT_MS 250
+#endif
+
+// The driver with all address pins low
+#define PCA9685_ADDRESS		0x40
+#define PCA9685_MODE1		0x00
+#define PCA9685_MODE1_AI	0x20	// auto increment, with SLEEP cleared
+#define PCA9685_LED0_ON_L	0x06	// 4 registers per channel: ON_L, ON_H, OFF_L, OFF_H
+#define PCA9685_FULL		0x10	// full on in ON_H, full off in OFF_H
+
+#define LEDS 5
+
+// Address, register and 4 registers for each of the 3 channels
+#define MESSAGE_BYTES (2 + 3 * 4)
+
+RING_DEFINE(RGBQueue, RGB, QUEUE_LENGTH)
+
+RGBQueue queue;
+
+// Set by the ISR when it leaves the bus idle, cleared by twi_start()
+volatile uint8_t twi_idle = 1;
+
+// Only ever modified by the ISR
+volatile uint16_t items_sent = 0;
+volatile uint16_t bytes_sent = 0;
+volatile uint16_t errors = 0;		// transactions cut short by a NACK or a lost arbitration
+
+// The transaction being sent, only used by the ISR
+static uint8_t message[MESSAGE_BYTES];
+static uint8_t message_len, message_pos;
+static uint8_t configured = 0;		// set by a MODE1 setup that went through, cleared by a NACK
+
+// SCL at TWI_KHZ, and the interrupt on
+static void TWI_Init(void) {
+	TWSR = 0;
+	TWBR = TWI_BITRATE;
+	TWCR = (1 << TWEN) | (1 << TWIE);
+	sei();
+}
+
+// Sends a START, after which the ISR keeps going until the queue is empty. Only called by
+// main() while the bus is idle, when the ISR does not run.
+static void twi_start(void) {
+	// The STOP the ISR left the bus with takes one SCL period
+	while (TWCR & (1 << TWSTO));
+	twi_idle = 0;
+	TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+}
+
+// Puts the next transaction in message: the MODE1 setup until it has gone through, then one
+// per item
+static void load_message(void) {
+	static uint8_t led = 0;
+
+	message[0] = (PCA9685_ADDRESS << 1) | TW_WRITE;
+	if (!configured) {
+		message[1] = PCA9685_MODE1;
+		message[2] = PCA9685_MODE1_AI;
+		message_len = 3;
+		return;
+	}
+
+	RGB rgb;
+	RGBQueue_dequeue(&queue, &rgb);
+
+	message[1] = PCA9685_LED0_ON_L + 12 * led;
+	led = led + 1 < LEDS ? led + 1 : 0;
+
+	uint8_t *p = &message[2];
+	const uint8_t *level = &rgb.r;
+	for (uint8_t c = 0; c < 3; c++) {
+		uint16_t off = level[c] * 16 + level[c] / 16;
+		*p++ = 0;
+		*p++ = level[c] == 255 ? PCA9685_FULL : 0;
+		*p++ = off;
+		*p++ = level[c] == 0 ? PCA9685_FULL : off >> 8;
+	}
+	message_len = MESSAGE_BYTES;
+}
+
+// The consumer, called whenever the TWI has finished what it was asked to do. The bus waits,
+// with SCL held low, until TWCR is written with TWINT set.
+ISR(TWI_vect) {
+	switch (TW_STATUS) {
+	case TW_START:
+	case TW_REP_START:
+		load_message();
+		message_pos = 0;
+		// fall through, to send the address
+	case TW_MT_SLA_ACK:
+	case TW_MT_DATA_ACK:
+		if (message_pos < message_len) {
+			TWDR = message[message_pos++];
+			TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+			return;
+		}
+		if (message_len == MESSAGE_BYTES)
+			items_sent++;
+		else
+			configured = 1;
+		bytes_sent += message_len;
+		break;
+	default:
+		// NACK or lost arbitration, the rest of the transaction is dropped. The chip may not
+		// be there or may have been reset, so it gets the MODE1 setup again first.
+		errors++;
+		configured = 0;
+		break;
+	}
+
+	// Straight on to the next transaction, or leave the bus idle until there is one
+	if (!RGBQueue_empty(&queue)) {
+		TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | (1 << TWIE);
+	} else {
+		twi_idle = 1;
+		TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN) | (1 << TWIE);
+	}
+}
+
+// The colour the next item has
+static RGB next_rgb;
+
+// The producer keeps the queue full, and wakes the bus up if it went idle
+static uint16_t produce(uint8_t unused) {
+	(void)unused;
+
+	while (!RGBQueue_full(&queue)) {
+		RGBQueue_enqueue(&queue, &next_rgb);
+
+		// Count through all 2^24 colors like main.c does
+		if (++next_rgb.b == 0 && ++next_rgb.g == 0)
+			++next_rgb.r;
+	}
+
+	if (twi_idle)
+		twi_start();
+
+	// Have another look on the next tick
+	return 1;
+}
+
+static uint16_t report(uint8_t unused) {
+	(void)unused;
+	static uint16_t last_items, last_bytes, last_tick;
+
+	uint16_t items, bytes, failed;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		items = items_sent;
+		bytes = bytes_sent;
+		failed = errors;
+	}
+
+	// Per second over the ticks since the last report, which is under 50000 bytes even at 400 kHz
+	uint16_t now = sched_now();
+	uint16_t ticks = now - last_tick;
+	uint16_t items_per_s = (uint16_t)(items - last_items) * (SCHED_TICKS_PER_MS * 1000UL) / ticks;
+	uint16_t bytes_per_s = (uint16_t)(bytes - last_bytes) * (SCHED_TICKS_PER_MS * 1000UL) / ticks;
+	last_items = items;
+	last_bytes = bytes;
+	last_tick = now;
+
+	LOG("##### TWI: %u kHz items/s %u bytes/s %u errors %u queue %u\n",
+		TWI_KHZ, items_per_s, bytes_per_s, failed, RGBQueue_count(&queue));
+	return REPORT_MS * SCHED_TICKS_PER_MS;
+}
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+	LOG("TWI PCA9685 Example\n\n");
+
+	sched_init();
+	TWI_Init();
+
+	// The setup transaction goes out before the first item
+	twi_start();
+
+	static Task tasks[] = { { produce, 0, 0 }, { report, 0, REPORT_MS * SCHED_TICKS_PER_MS } };
+	sched_run(tasks, 2);
+
+	return 0;
+}
@@ -0,0 +1,214 @@
+// Name: uart_rx.c
+//
+// The USART receive complete ISR as the producer: a host streams raw pixel data (3 bytes per
+// pixel, FRAME_PIXELS pixels per frame, frame after frame) and main() is the consumer that
+// shows it, a pixel at a time and then a pause to latch each frame, like an LED strip would.
+// That takes longer than the data takes to arrive at 115200 baud, so the sender has to be told
+// to stop now and then.
+//
+// The ISR enqueues every byte. Once the queue reaches RX_HIGH_WATER it stops the sender, and
+// once main() has drained it to RX_LOW_WATER main() lets the sender go on. FLOW_CONTROL selects
+// how:
+//
+//   FLOW_XONXOFF  XOFF (0x13) and XON (0x11) are sent to the host, which works over any serial
+//                 link, but the log output must not contain those bytes, so not with LOG_DEFERRED
+//   FLOW_RTS      RTS on pin PD4, connected to CTS of the sender, high to stop
+//   FLOW_NONE     nothing, to see what the queue alone can absorb
+//
+// The sender does not stop on the spot, the bytes it has already passed on to its own FIFO or
+// driver keep coming. The QUEUE_LENGTH - 1 - RX_HIGH_WATER bytes above the high water mark must
+// hold them, or they are dropped and counted as overruns, like the bytes the USART itself had
+// to drop because the ISR did not read UDR0 in time (DOR0).
+//
+// Whether the sender is stopped is kept as two counters, so that each has only one writer: the
+// ISR counts the stops and main() the resumes, and the sender is stopped while they differ.
+//
+// tools/stream sends the frames and honours the flow control. Build with "make TARGET=uart_rx".
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+
+// Only main() logs, so that the ISR is never held off for a whole line, but the ISR transmits
+// XOFF, so the transmitter is shared
+#define LOG_SINGLE_CONTEXT
+#define USART_SHARED_TX
+#include "log.h"
+#include "ring.h"
+#include "sched.h"
+
+#define FLOW_NONE		0
+#define FLOW_XONXOFF	1
+#define FLOW_RTS		2
+
+#ifndef FLOW_CONTROL
+#define FLOW_CONTROL FLOW_XONXOFF
+#endif
+
+#if FLOW_CONTROL == FLOW_XONXOFF && defined(LOG_DEFERRED)
+#error "The binary frames of LOG_DEFERRED may contain XON and XOFF, use FLOW_RTS"
+#endif
+
+#define XON		0x11
+#define XOFF	0x13
+
+// Holds 22 ms of data at 115200 baud
+#ifndef QUEUE_LENGTH
+#define QUEUE_LENGTH 256
+#endif
+
+#if QUEUE_LENGTH > 256
+#error "QUEUE_LENGTH must fit the uint8_t head and tail indices"
+#endif
+
+#ifndef RX_HIGH_WATER
+#define RX_HIGH_WATER (QUEUE_LENGTH * 3 / 4)
+#endif
+
+#ifndef RX_LOW_WATER
+#define RX_LOW_WATER (QUEUE_LENGTH / 4)
+#endif
+
+#if RX_LOW_WATER >= RX_HIGH_WATER || RX_HIGH_WATER >= QUEUE_LENGTH
+#error "Need RX_LOW_WATER < RX_HIGH_WATER < QUEUE_LENGTH"
+#endif
+
+#ifndef FRAME_PIXELS
+#define FRAME_PIXELS 64
+#endif
+
+// Time to shift out one pixel, 24 bits at 1.25 us for a WS2812
+#ifndef PIXEL_US
+#define PIXEL_US 30
+#endif
+
+// Pause after each frame
+#ifndef FRAME_LATCH_MS
+#define FRAME_LATCH_MS 20
+#endif
+
+// Print the counters every this many frames
+#ifndef REPORT_EVERY
+#define REPORT_EVERY 32
+#endif
+
+RING_DEFINE(ByteQueue, uint8_t, QUEUE_LENGTH)
+
+ByteQueue queue;
+
+// The sender is stopped while these differ, see above
+volatile uint8_t stops = 0;		// only ever modified by the ISR
+volatile uint8_t resumes = 0;	// only ever modified by main()
+
+// Bytes lost, only ever modified by the ISR
+volatile uint16_t overruns = 0;
+
+// Only ever modified by main()
+uint16_t bytes = 0;
+
+static inline void stop_sender(void) {
+#if FLOW_CONTROL == FLOW_XONXOFF
+	USART_Transmit(XOFF);
+#elif FLOW_CONTROL == FLOW_RTS
+	PORTD |= (1 << PD4);
+#endif
+}
+
+static inline void resume_sender(void) {
+#if FLOW_CONTROL == FLOW_XONXOFF
+	USART_Transmit(XON);
+#elif FLOW_CONTROL == FLOW_RTS
+	PORTD &= ~(1 << PD4);		// a single cbi, so the ISR's sbi cannot get lost
+#endif
+}
+
+// The producer
+ISR(USART_RX_vect) {
+	// The status belongs to the byte in UDR0, so it has to be read first
+	uint8_t status = UCSR0A;
+	uint8_t data = UDR0;
+
+	if (status & (1 << DOR0))
+		overruns++;
+	if (ByteQueue_full(&queue)) {
+		overruns++;
+		return;
+	}
+	ByteQueue_enqueue(&queue, &data);
+
+#if FLOW_CONTROL != FLOW_NONE
+	if (stops == resumes && ByteQueue_count(&queue) >= RX_HIGH_WATER) {
+		stop_sender();
+		stops++;
+	}
+#endif
+}
+
+// The consumer, it shows a frame a few pixels per run and then latches it
+static uint16_t consume(uint8_t unused) {
+	static uint8_t pixels = 0;
+	static uint8_t frames = 0;
+	static uint8_t last_stops = 0;
+	static uint16_t last_overruns = 0;
+	(void)unused;
+
+	for (uint8_t i = 0; i < 8 && ByteQueue_count(&queue) >= 3; i++) {
+		uint8_t pixel[3];
+		for (uint8_t j = 0; j < 3; j++)
+			ByteQueue_dequeue(&queue, &pixel[j]);
+		bytes += 3;
+
+		// Stands in for shifting the pixel out
+		_delay_us(PIXEL_US);
+
+#if FLOW_CONTROL != FLOW_NONE
+		if (stops != resumes && ByteQueue_count(&queue) <= RX_LOW_WATER) {
+			resume_sender();
+			resumes = stops;
+		}
+#endif
+
+		if (++pixels < FRAME_PIXELS)
+			continue;
+		pixels = 0;
+
+		if (++frames == REPORT_EVERY) {
+			frames = 0;
+
+			uint16_t total;
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				total = overruns;
+			}
+			uint8_t stopped = stops;
+			LOG("##### RX: frames %u bytes %u stalls %u overruns %u\n", REPORT_EVERY, bytes,
+				(uint8_t)(stopped - last_stops), (uint16_t)(total - last_overruns));
+			last_stops = stopped;
+			last_overruns = total;
+			bytes = 0;
+		}
+		return FRAME_LATCH_MS * SCHED_TICKS_PER_MS;
+	}
+
+	// A pixel takes 260 us to come in at 115200 baud
+	return 1;
+}
+
+int main(void) {
+	USART_Init();
+	USART_115200();
+	LOG("UART Receive Example\n\n");
+
+#if FLOW_CONTROL == FLOW_RTS
+	DDRD |= (1 << PD4);			// low, the sender may go ahead
+#endif
+	sched_init();
+	USART_InitReceiver(1);
+	sei();
+
+	static Task tasks[] = { { consume, 0, 0 } };
+	sched_run(tasks, 1);
+
+	return 0;
+}
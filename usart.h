@@ -0,0 +1,78 @@
+// Name: usart.h
+//
+// USART 0 helpers shared by the example programs. USART_Init() only enables the transmitter,
+// programs that receive as well call USART_InitReceiver() too. Every byte is sent by polling
+// UDRE0, from main() or from an ISR alike.
+//
+// A byte written while UDR0 is still full is lost, so when main() transmits outside of an
+// ATOMIC_BLOCK and an ISR transmits too (a flow control character, say), the check and the
+// write must not be split up by the ISR. Define USART_SHARED_TX before including this file to
+// make USART_Transmit() do both with interrupts disabled, which holds them off for a few cycles
+// per byte instead of for a whole line.
+
+#ifndef USART_H
+#define USART_H
+
+#include <avr/io.h>
+#ifdef USART_SHARED_TX
+#include <util/atomic.h>
+#endif
+
+// Standard USART initialization, except we only enable the transmitter
+static inline void USART_Init(void) {
+	// Enable transmitter only
+	UCSR0B |= (1 << TXEN0);
+}
+
+// Enables the receiver as well, and its interrupt if rx_interrupt is set
+static inline void USART_InitReceiver(uint8_t rx_interrupt) {
+	UCSR0B |= (1 << RXEN0) | (rx_interrupt ? (1 << RXCIE0) : 0);
+}
+
+// Standard way to set the baud rate using avr-libc's helper 'bacros'
+static inline void USART_115200(void) {
+#undef BAUD  // avoid potential compiler warning
+#define BAUD 115200
+#include <util/setbaud.h>
+	UBRR0H = UBRRH_VALUE;
+	UBRR0L = UBRRL_VALUE;
+#if USE_2X
+	UCSR0A |= (1 << U2X0);
+#else
+	UCSR0A &= ~(1 << U2X0);
+#endif
+}
+
+// Standard way to transmit a character over the USART
+static inline void USART_Transmit(unsigned char data) {
+#ifdef USART_SHARED_TX
+	// Wait for empty transmit buffer and fill it before an ISR can
+	for (;;) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if (UCSR0A & (1 << UDRE0)) {
+				UDR0 = data;
+				return;
+			}
+		}
+	}
+#else
+	// Wait for empty transmit buffer
+	while (!(UCSR0A & (1 << UDRE0)));
+	
+	// Put data into buffer, sends the data
+	UDR0 = data;
+#endif
+}
+
+// Standard way to transmist a string over the USART. Strings are printed from both the ISR and
+// main(), so callers in main() wrap this in an ATOMIC_BLOCK, which will disable interrupts
+// if enabled, print the string, and then restore interrupts if they were enabled. This is
+// done solely to prevent the strings printed from the ISR and main() from getting mixed
+// together in the middle of a line. If we did not print from both main() and the ISR, we
+// would not have to disable interrupts!
+static inline void USART_TransmitString(const char *data) {
+	while (*data)
+		USART_Transmit(*data++);
+}
+
+#endif // USART_H
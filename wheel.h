@@ -0,0 +1,85 @@
+// Name: wheel.h
+//
+// Timer wheel for running several periodic jobs from one timer interrupt, e.g. consumers that
+// each dequeue from their own queue at their own rate:
+//
+//   WHEEL_DEFINE(ConsumerWheel, 16, 4)
+//
+// defines the type ConsumerWheel, for wheels of 16 slots that schedule the jobs 0 to 3, and the
+// functions ConsumerWheel_schedule(), ConsumerWheel_advance() and ConsumerWheel_pop(), which all
+// take a pointer to the wheel. A zero-initialised wheel (e.g. a global) has nothing scheduled.
+//
+// The wheel counts timer ticks. schedule() puts a job in the slot of the tick it is due at,
+// modulo the number of slots, with the number of times the wheel has to go round before then.
+// advance(), called once per tick, moves on to the next slot and takes the jobs in it that are
+// due, leaving the others with one round less. pop() then returns them one by one, and
+// WHEEL_NONE when there are no more. A job runs once per schedule(), so a periodic job is
+// scheduled again after each run:
+//
+//   ConsumerWheel_advance(&wheel);
+//   for (uint8_t job; (job = ConsumerWheel_pop(&wheel)) != WHEEL_NONE; )
+//       ConsumerWheel_schedule(&wheel, job, run(job));
+//
+// A tick only looks at the jobs in its own slot, instead of every job, so with periods up to
+// the number of slots it costs the same however many jobs are waiting, plus the jobs it runs.
+// Jobs with longer periods are looked at once per round. The number of slots must be a power
+// of 2, and there can be at most 255 jobs, each of which is scheduled at most once at a time.
+// A delay is at least 1 (the next tick) and at most 256 rounds, i.e. 256 * slots ticks.
+//
+// All the functions are meant to be called from ISRs only, which do not interrupt each other.
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+#define WHEEL_NONE 0xFF
+
+// The lists are linked through job + 1, so that 0 (a zeroed slot) ends them
+#define WHEEL_DEFINE(name, slots, jobs)												\
+	typedef struct {																\
+		uint8_t slot[slots];		/* first job + 1 in each slot */				\
+		uint8_t next[jobs];			/* next job + 1 in the same list */			\
+		uint8_t rounds[jobs];		/* times to go round before the job is due */	\
+		uint8_t due;				/* first job + 1 taken by advance() */			\
+		uint8_t now;				/* slot of the current tick */					\
+	} name;																			\
+																					\
+	typedef char name##_slots_check[((slots) & ((slots) - 1)) == 0 ? 1 : -1];		\
+	typedef char name##_jobs_check[(jobs) <= 255 ? 1 : -1];						\
+																					\
+	static inline void name##_schedule(name *w, uint8_t job, uint16_t delay) {		\
+		uint8_t s = (w->now + delay) & ((slots) - 1);								\
+																					\
+		w->rounds[job] = (delay - 1) / (slots);										\
+		w->next[job] = w->slot[s];													\
+		w->slot[s] = job + 1;														\
+	}																				\
+																					\
+	static inline void name##_advance(name *w) {									\
+		uint8_t s = w->now = (w->now + 1) & ((slots) - 1);							\
+		uint8_t *link = &w->slot[s];												\
+																					\
+		while (*link) {																\
+			uint8_t job = *link - 1;												\
+																					\
+			if (w->rounds[job]) {													\
+				w->rounds[job]--;													\
+				link = &w->next[job];												\
+			} else {																\
+				*link = w->next[job];												\
+				w->next[job] = w->due;												\
+				w->due = job + 1;													\
+			}																		\
+		}																			\
+	}																				\
+																					\
+	static inline uint8_t name##_pop(name *w) {										\
+		if (!w->due)																\
+			return WHEEL_NONE;														\
+		uint8_t job = w->due - 1;													\
+		w->due = w->next[job];														\
+		return job;																	\
+	}
+
+#endif
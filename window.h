@@ -0,0 +1,105 @@
+// Name: window.h
+//
+// Statistics over the last N items a consumer has dequeued, kept up to date as items come in
+// instead of rescanning them:
+//
+//   WINDOW_DEFINE(SampleWindow, uint16_t, uint32_t, 64)
+//
+// defines the type SampleWindow, for windows of the last 64 uint16_t values with their sum in a
+// uint32_t, and the functions SampleWindow_push(), SampleWindow_count(), SampleWindow_sum(),
+// SampleWindow_mean(), SampleWindow_min() and SampleWindow_max(), which all take a pointer to
+// the window. A zero-initialised window (e.g. a global) is empty. The sum type must hold
+// N times the largest value.
+//
+// push() adds a value and drops the oldest one once there are N. The sum is updated with both.
+// The minimum and maximum each come from a monotonic queue of the window slots that can still
+// become the minimum (maximum): a new value removes the slots at the back with larger (smaller)
+// values, which can never be the minimum (maximum) again while it is in the window, and the
+// front is dropped when its slot leaves the window. The front is thus always the minimum
+// (maximum), and each slot is added and removed once, so push() takes constant time on
+// average, and the statistics always.
+//
+// A window belongs to one side of a queue, usually the consumer, which pushes what it dequeues.
+// It is not kept by ring.h on enqueue and dequeue, as statistics over the queued items: the sum
+// and both monotonic queues would then be changed by the producer and the consumer alike, and
+// ring.h can do without locking only because each of its indices has a single writer. A window
+// over the items a consumer has taken is also what a consumer averages over, whereas what is
+// queued depends on how far ahead the producer happens to be.
+//
+// min(), max() and mean() must not be called on an empty window. N can be at most 255.
+// tools/window checks the statistics against a brute-force rescan.
+
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdint.h>
+
+#define WINDOW_DEFINE(name, type, sum_type, length)									\
+	typedef struct {																\
+		type values[length];		/* the window, the oldest value at next */		\
+		sum_type sum;																\
+		uint8_t next;				/* slot the next value goes in */				\
+		uint8_t count;																\
+		uint8_t min[length];		/* slots, smallest value first */				\
+		uint8_t min_front, min_count;												\
+		uint8_t max[length];		/* slots, largest value first */				\
+		uint8_t max_front, max_count;												\
+	} name;																			\
+																					\
+	typedef char name##_length_check[(length) <= 255 ? 1 : -1];						\
+																					\
+	static inline void name##_push(name *w, type value) {							\
+		uint8_t slot = w->next;														\
+																					\
+		/* The oldest value leaves, and with it the fronts that are its slot */	\
+		if (w->count == (length)) {													\
+			w->sum -= w->values[slot];												\
+			if (w->min_count && w->min[w->min_front] == slot) {						\
+				w->min_front = (w->min_front + 1) % (length);						\
+				w->min_count--;														\
+			}																		\
+			if (w->max_count && w->max[w->max_front] == slot) {						\
+				w->max_front = (w->max_front + 1) % (length);						\
+				w->max_count--;														\
+			}																		\
+		} else {																	\
+			w->count++;																\
+		}																			\
+		w->values[slot] = value;													\
+		w->sum += value;															\
+		w->next = (slot + 1) % (length);											\
+																					\
+		/* Slots with values the new one beats can never be at the front again */	\
+		while (w->min_count &&														\
+			   w->values[w->min[(w->min_front + w->min_count - 1) % (length)]] > value)	\
+			w->min_count--;															\
+		w->min[(w->min_front + w->min_count++) % (length)] = slot;					\
+		while (w->max_count &&														\
+			   w->values[w->max[(w->max_front + w->max_count - 1) % (length)]] < value)	\
+			w->max_count--;															\
+		w->max[(w->max_front + w->max_count++) % (length)] = slot;					\
+	}																				\
+																					\
+	/* Number of values in the window, N once it has filled up */				\
+	static inline uint8_t name##_count(const name *w) {								\
+		return w->count;															\
+	}																				\
+																					\
+	static inline sum_type name##_sum(const name *w) {								\
+		return w->sum;																\
+	}																				\
+																					\
+	/* Rounded towards zero */														\
+	static inline type name##_mean(const name *w) {									\
+		return w->sum / w->count;													\
+	}																				\
+																					\
+	static inline type name##_min(const name *w) {									\
+		return w->values[w->min[w->min_front]];										\
+	}																				\
+																					\
+	static inline type name##_max(const name *w) {									\
+		return w->values[w->max[w->max_front]];										\
+	}
+
+#endif // WINDOW_H